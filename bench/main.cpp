@@ -0,0 +1,333 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <estd/filesystem.hpp>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Benchmarks for the copy, iteration, removal and Path operations on synthetic trees, results go to stdout as JSON.
+//   runbench [--scale N] [--repeat N] [--filter text] [--root dir]
+// --scale multiplies the size of every tree, --repeat runs every operation N times and keeps the fastest run,
+// --filter only runs the benchmarks whose "shape/operation" contains the text, --root is where the trees are made.
+
+static std::atomic<size_t> allocations{0}; // heap allocations, reported per operation
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace fs = estd::files;
+
+namespace {
+    // read and write system calls of the whole process (task io accounting), -1 if the kernel does not provide it
+    struct SyscallCounts {
+        int64_t reads = -1;
+        int64_t writes = -1;
+
+        static SyscallCounts now() {
+            SyscallCounts c;
+            std::ifstream io("/proc/self/io");
+            std::string key;
+            int64_t value;
+            while (io >> key >> value) {
+                if (key == "syscr:") c.reads = value;
+                if (key == "syscw:") c.writes = value;
+            }
+            return c;
+        }
+        // the calls now() itself makes between two snapshots
+        static SyscallCounts overhead() {
+            SyscallCounts a = now(), b = now();
+            return {b.reads - a.reads, b.writes - a.writes};
+        }
+    };
+
+    struct Tree {
+        fs::Path root;
+        uint64_t files = 0; // regular files and soft links
+        uint64_t bytes = 0;
+    };
+
+    struct Result {
+        std::string shape;
+        std::string operation;
+        uint64_t items = 0; // files of the tree, or calls for the Path operations
+        uint64_t bytes = 0;
+        double seconds = 0;
+        size_t allocations = 0;
+        int64_t readSyscalls = -1;
+        int64_t writeSyscalls = -1;
+    };
+
+    struct Options {
+        uint64_t scale = 1;
+        size_t repeat = 3;
+        std::string filter;
+        fs::Path root = "bench_trees/";
+    };
+
+    void writeFile(const fs::Path& p, uint64_t size, Tree& tree) {
+        static const std::string chunk(1 << 20, 'x');
+        std::ofstream out(p.string(), std::ios::binary);
+        for (uint64_t left = size; left > 0;) {
+            size_t n = size_t(std::min<uint64_t>(left, chunk.size()));
+            out.write(chunk.data(), std::streamsize(n));
+            left -= n;
+        }
+        tree.files++;
+        tree.bytes += size;
+    }
+
+    // a single directory with many small files
+    Tree makeWide(const fs::Path& root, uint64_t scale) {
+        Tree t{root};
+        fs::createDirectories(root);
+        for (uint64_t i = 0; i < 5000 * scale; i++) writeFile(root + ("f" + std::to_string(i)), 1024, t);
+        return t;
+    }
+
+    // a long chain of directories with a few files on every level
+    Tree makeDeep(const fs::Path& root, uint64_t scale) {
+        Tree t{root};
+        fs::Path dir = root;
+        for (uint64_t depth = 0; depth < std::min<uint64_t>(100 * scale, 1000); depth++) {
+            dir = dir + "d/";
+            fs::createDirectories(dir);
+            writeFile(dir + "a", 4096, t);
+            writeFile(dir + "b", 4096, t);
+        }
+        return t;
+    }
+
+    // many directories full of tiny files
+    Tree makeTiny(const fs::Path& root, uint64_t scale) {
+        Tree t{root};
+        for (uint64_t d = 0; d < 100 * scale; d++) {
+            fs::Path dir = root + ("d" + std::to_string(d) + "/");
+            fs::createDirectories(dir);
+            for (int i = 0; i < 100; i++) writeFile(dir + ("f" + std::to_string(i)), 16, t);
+        }
+        return t;
+    }
+
+    // a few large files
+    Tree makeHuge(const fs::Path& root, uint64_t scale) {
+        Tree t{root};
+        fs::createDirectories(root);
+        for (uint64_t i = 0; i < 4 * scale; i++) writeFile(root + ("big" + std::to_string(i)), 16 << 20, t);
+        return t;
+    }
+
+    // files with soft links to them and to their directories
+    Tree makeSymlinks(const fs::Path& root, uint64_t scale) {
+        Tree t{root};
+        for (uint64_t d = 0; d < 50 * scale; d++) {
+            const std::string name = "d" + std::to_string(d);
+            fs::Path dir = root + (name + "/");
+            fs::createDirectories(dir);
+            for (int i = 0; i < 20; i++) {
+                const std::string file = "f" + std::to_string(i);
+                writeFile(dir + file, 256, t);
+                fs::createSoftLinkRelative(file, dir + (file + ".link"));
+                t.files++;
+            }
+            fs::createSoftLinkRelative(name, root + (name + ".link"));
+            t.files++;
+        }
+        return t;
+    }
+
+    class Bench {
+    private:
+        Options options;
+        std::vector<Result> results;
+        SyscallCounts overhead = SyscallCounts::overhead();
+
+        bool selected(const std::string& name) const {
+            return options.filter.empty() || name.find(options.filter) != std::string::npos;
+        }
+
+    public:
+        explicit Bench(Options options) : options(std::move(options)) {}
+
+        // runs op `repeat` times after setup (not measured) and keeps the fastest run
+        void run(
+            const std::string& shape, const std::string& operation, uint64_t items, uint64_t bytes,
+            const std::function<void()>& op, const std::function<void()>& setup = nullptr
+        ) {
+            if (!selected(shape + "/" + operation)) return;
+            Result best;
+            for (size_t i = 0; i < options.repeat; i++) {
+                if (setup) setup();
+                SyscallCounts before = SyscallCounts::now();
+                size_t allocationsBefore = allocations;
+                auto start = std::chrono::steady_clock::now();
+                op();
+                auto end = std::chrono::steady_clock::now();
+                size_t allocated = allocations - allocationsBefore;
+                SyscallCounts after = SyscallCounts::now();
+                double seconds = std::chrono::duration<double>(end - start).count();
+                if (i > 0 && seconds >= best.seconds) continue;
+                best = {shape, operation, items, bytes, seconds, allocated};
+                if (before.reads >= 0) best.readSyscalls = after.reads - before.reads - overhead.reads;
+                if (before.writes >= 0) best.writeSyscalls = after.writes - before.writes - overhead.writes;
+            }
+            std::cerr << shape << "/" << operation << ": " << best.seconds << " s" << std::endl;
+            results.push_back(best);
+        }
+
+        void runTree(const std::string& shape, const std::function<Tree(const fs::Path&, uint64_t)>& make) {
+            const fs::Path src = options.root + (shape + "/src/");
+            const fs::Path dst = options.root + (shape + "/dst/");
+            const std::string prefix = shape + "/";
+            bool any = false;
+            for (const char* op : {"copy", "copyParallel", "copyBatched", "iterate", "walkParallel", "diskUsage",
+                                   "treeDiff", "remove", "removeParallel"}) {
+                any = any || selected(prefix + op);
+            }
+            if (!any) return;
+
+            fs::remove(options.root + (shape + "/"));
+            const Tree tree = make(src, options.scale);
+            const uint64_t n = tree.files, bytes = tree.bytes;
+            auto clean = [&] { fs::remove(dst); };
+            auto copied = [&] {
+                if (!fs::exists(dst)) fs::copy(src, dst, fs::CopyOptions::recursive);
+            };
+
+            run(shape, "copy", n, bytes, [&] { fs::copy(src, dst, fs::CopyOptions::recursive); }, clean);
+            run(
+                shape, "copyParallel", n, bytes,
+                [&] { fs::copy(src, dst, fs::CopyOptions::recursive | fs::CopyOptions::parallel); }, clean
+            );
+            run(shape, "copyBatched", n, bytes, [&] { fs::copyBatched(src, dst); }, clean);
+            run(shape, "iterate", n, 0, [&] {
+                size_t count = 0;
+                for (const auto& e : fs::RecursiveDirectoryIterator(src)) count += !e.path().view().empty();
+                if (count == 0) throw std::runtime_error("empty tree");
+            });
+            run(shape, "walkParallel", n, 0, [&] {
+                std::atomic<size_t> count{0};
+                fs::walkParallel(src, [&](const fs::FastDirectoryEntry&) {
+                    count++;
+                    return fs::WalkAction::proceed;
+                });
+            });
+#ifdef __linux__
+            run(shape, "diskUsage", n, 0, [&] { fs::diskUsage(src); });
+#endif
+            run(shape, "treeDiff", n, 0, [&] { fs::treeDiff(src, dst); }, copied);
+            run(shape, "remove", n, 0, [&] { fs::remove(dst); }, copied);
+            run(shape, "removeParallel", n, 0, [&] { fs::removeParallel(dst); }, copied);
+            fs::remove(options.root + (shape + "/"));
+        }
+
+        void runPath() {
+            const uint64_t n = 200000 * options.scale;
+            std::vector<fs::Path> paths, normalPaths; // with "." and ".." to collapse, and already normal
+            for (uint64_t i = 0; i < 1000; i++) {
+                paths.push_back("/srv/data/./project" + std::to_string(i % 37) + "/src/../include/file" +
+                                std::to_string(i) + ".hpp");
+                normalPaths.push_back(paths.back().normalize());
+            }
+            run("path", "normalize", n, 0, [&] {
+                for (uint64_t i = 0; i < n; i++) paths[i % paths.size()].normalize();
+            });
+            paths = normalPaths;
+            run("path", "replacePrefix", n, 0, [&] {
+                for (uint64_t i = 0; i < n; i++) paths[i % paths.size()].replacePrefix("/srv/data/", "/backup/");
+            });
+            run("path", "prefixRewriter", n, 0, [&] {
+                fs::PrefixRewriter rewriter("/srv/data/", "/backup/");
+                std::string out;
+                for (uint64_t i = 0; i < n; i++) rewriter.rewrite(paths[i % paths.size()], out);
+            });
+            run("path", "components", n, 0, [&] {
+                size_t count = 0;
+                for (uint64_t i = 0; i < n; i++) {
+                    for (auto c : paths[i % paths.size()].components()) count += c.view().size();
+                }
+                if (count == 0) throw std::runtime_error("no components");
+            });
+            run("path", "componentAt", n, 0, [&] {
+                size_t count = 0;
+                for (uint64_t i = 0; i < n; i++) {
+                    const fs::Path& path = paths[i % paths.size()];
+                    count += path.componentAt(path.componentCount() - 2).size() + path.viewSuffix().second.size();
+                }
+                if (count == 0) throw std::runtime_error("no components");
+            });
+        }
+
+        void writeJson(std::ostream& out) const {
+            auto number = [](double v) {
+                std::ostringstream s;
+                s.precision(6);
+                s << v;
+                return s.str();
+            };
+            auto optional = [](int64_t v) { return v < 0 ? std::string("null") : std::to_string(v); };
+            out << "{\n  \"library\": \"estd_filesystem\",\n  \"scale\": " << options.scale
+                << ",\n  \"repeat\": " << options.repeat << ",\n  \"results\": [";
+            for (size_t i = 0; i < results.size(); i++) {
+                const Result& r = results[i];
+                const double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+                const double items = r.items > 0 ? double(r.items) : 1;
+                out << (i ? ",\n" : "\n") << "    {\"shape\": \"" << r.shape << "\", \"operation\": \""
+                    << r.operation << "\", \"items\": " << r.items << ", \"bytes\": " << r.bytes
+                    << ", \"seconds\": " << number(r.seconds) << ", \"itemsPerSecond\": " << number(r.items / seconds)
+                    << ", \"megabytesPerSecond\": " << number(r.bytes / seconds / 1e6)
+                    << ", \"allocations\": " << r.allocations
+                    << ", \"allocationsPerItem\": " << number(r.allocations / items)
+                    << ", \"readSyscalls\": " << optional(r.readSyscalls)
+                    << ", \"writeSyscalls\": " << optional(r.writeSyscalls) << "}";
+            }
+            out << "\n  ]\n}\n";
+        }
+    };
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string arg = argv[i];
+        if (arg == "--scale") {
+            options.scale = std::max<uint64_t>(1, std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (arg == "--repeat") {
+            options.repeat = std::max<size_t>(1, std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (arg == "--filter") {
+            options.filter = argv[i + 1];
+        } else if (arg == "--root") {
+            options.root = fs::Path(argv[i + 1]).addEmptySuffix();
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    Bench bench(options);
+    try {
+        bench.runPath();
+        bench.runTree("wide", makeWide);
+        bench.runTree("deep", makeDeep);
+        bench.runTree("tiny", makeTiny);
+        bench.runTree("huge", makeHuge);
+        bench.runTree("symlinks", makeSymlinks);
+        fs::remove(options.root);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    bench.writeJson(std::cout);
+    return 0;
+}
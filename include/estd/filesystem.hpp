@@ -30,34 +30,337 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <estd/ptr.hpp>
 #include <estd/string_util.h>
 #include <exception>
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <set>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#ifdef __linux__
+    #include <dirent.h>
+    #include <fcntl.h>
+    #include <linux/fs.h>
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <sys/ioctl.h>
+    #include <sys/mman.h>
+    #include <sys/sendfile.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #ifndef FICLONE
+        #define FICLONE _IOW(0x94, 9, int)
+    #endif
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #define ESTD_FILES_HAS_IO_URING
+    #endif
+#endif
+
 namespace estd {
     namespace files {
         class FileException : public std::runtime_error {
         public:
             using std::runtime_error::runtime_error;
         };
+        class Path;
+
+        // Non owning view of a path string, offers the read only queries and splits of Path without allocating.
+        // The viewed string must outlive the view.
+        class PathView {
+        private:
+            std::string_view path;
+
+            std::pair<PathView, std::string_view> splitExtentionAt(bool longExtention) const noexcept {
+                if (isDirectory()) return {*this, ""};
+                size_t suffixPos = path.size() - getSuffix().size();
+                std::string_view source = path.substr(suffixPos);
+                if (!source.empty() && source.front() == '.') {
+                    source.remove_prefix(1); // hidden file, the leading dot is not an extention
+                    suffixPos++;
+                }
+                size_t mid_pos = longExtention ? source.find('.') : source.rfind('.');
+                if (mid_pos == std::string_view::npos) return {*this, ""};
+                return {PathView(path.substr(0, suffixPos + mid_pos)), path.substr(suffixPos + mid_pos)};
+            }
+
+        public:
+            constexpr PathView() noexcept {}
+            constexpr PathView(std::string_view source) noexcept : path(source) {}
+            constexpr PathView(const char* source) noexcept : path(source) {}
+            PathView(const std::string& source) noexcept : path(source) {}
+            PathView(const Path& source) noexcept;
+
+            friend bool operator==(PathView lhs, PathView rhs) noexcept { return lhs.path == rhs.path; }
+            friend bool operator!=(PathView lhs, PathView rhs) noexcept { return lhs.path != rhs.path; }
+            friend bool operator<(PathView lhs, PathView rhs) noexcept { return lhs.path < rhs.path; }
+            friend bool operator>(PathView lhs, PathView rhs) noexcept { return lhs.path > rhs.path; }
+            friend bool operator<=(PathView lhs, PathView rhs) noexcept { return lhs.path <= rhs.path; }
+            friend bool operator>=(PathView lhs, PathView rhs) noexcept { return lhs.path >= rhs.path; }
+
+            friend std::ostream& operator<<(std::ostream& stream, PathView p) {
+                return stream << "\"" << p.path << "\"";
+            }
+
+            std::string_view view() const noexcept { return path; }
+            std::string string() const { return std::string(path); }
+            bool empty() const noexcept { return path.empty(); }
+            size_t size() const noexcept { return path.size(); }
+
+            bool isFile() const noexcept { return hasSuffix(); }
+            bool isDirectory() const noexcept { return !hasSuffix(); }
+            PathView removeEmptySuffix() const noexcept { return hasSuffix() ? *this : splitSuffix().first; }
+            PathView removeEmptyPrefix() const noexcept { return hasPrefix() ? *this : splitPrefix().second; }
+            bool hasPrefix() const noexcept { return !splitPrefix().first.empty(); }
+            bool hasSuffix() const noexcept { return !splitSuffix().second.empty(); }
+            PathView getPrefix() const noexcept { return splitPrefix().first; }
+            PathView getSuffix() const noexcept { return splitSuffix().second; }
+            bool hasAntiPrefix() const noexcept { return !splitPrefix().second.empty(); }
+            bool hasAntiSuffix() const noexcept { return !splitSuffix().first.empty(); }
+            PathView getAntiPrefix() const noexcept { return splitPrefix().second; }
+            PathView getAntiSuffix() const noexcept { return splitSuffix().first; }
+
+            bool hasExtention() const noexcept { return !splitLongExtention().second.empty(); }
+            std::string_view getExtention() const noexcept { return splitExtention().second; }
+            std::string_view getLongExtention() const noexcept { return splitLongExtention().second; }
+
+            std::pair<PathView, std::string_view> splitExtention() const noexcept { return splitExtentionAt(false); }
+            std::pair<PathView, std::string_view> splitLongExtention() const noexcept {
+                return splitExtentionAt(true);
+            }
+
+            std::pair<PathView, PathView> splitPrefix() const noexcept {
+                size_t mid_pos = path.find('/');
+                if (mid_pos == std::string_view::npos) return {*this, PathView()};
+                return {PathView(path.substr(0, mid_pos)), PathView(path.substr(mid_pos + 1))};
+            }
+
+            std::pair<PathView, PathView> splitSuffix() const noexcept {
+                size_t mid_pos = path.rfind('/');
+                if (mid_pos == std::string_view::npos) return {PathView(), *this};
+                return {PathView(path.substr(0, mid_pos)), PathView(path.substr(mid_pos + 1))};
+            }
+
+            // walks the components between separators without allocating, "a/b/" yields "a", "b", ""
+            class ComponentIterator {
+            private:
+                std::string_view path;
+                size_t first = std::string_view::npos; // npos marks the end iterator
+                size_t last = 0;
+
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = PathView;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const PathView*;
+                using reference = PathView;
+
+                ComponentIterator() noexcept {}
+                explicit ComponentIterator(std::string_view source) noexcept : path(source), first(0) {
+                    last = std::min(path.find('/'), path.size());
+                }
+
+                PathView operator*() const noexcept { return PathView(path.substr(first, last - first)); }
+                ComponentIterator& operator++() noexcept {
+                    if (last >= path.size()) {
+                        first = std::string_view::npos;
+                        return *this;
+                    }
+                    first = last + 1;
+                    last = std::min(path.find('/', first), path.size());
+                    return *this;
+                }
+                ComponentIterator operator++(int) noexcept {
+                    ComponentIterator old = *this;
+                    ++*this;
+                    return old;
+                }
+                friend bool operator==(const ComponentIterator& lhs, const ComponentIterator& rhs) noexcept {
+                    return lhs.first == rhs.first;
+                }
+                friend bool operator!=(const ComponentIterator& lhs, const ComponentIterator& rhs) noexcept {
+                    return lhs.first != rhs.first;
+                }
+            };
+
+            class Components {
+            private:
+                std::string_view path;
+
+            public:
+                explicit Components(std::string_view source) noexcept : path(source) {}
+                ComponentIterator begin() const noexcept { return ComponentIterator(path); }
+                ComponentIterator end() const noexcept { return ComponentIterator(); }
+            };
+
+            Components components() const noexcept { return Components(path); }
+        };
+
+        // The separator and extention positions are indexed by the first query and kept until the path is modified,
+        // so the suffix, prefix, extention and component queries are O(1) and building a path scans nothing.
+        // Only the thread that claims the index writes it and queries that find it being built scan the string
+        // instead, so a const Path can be shared by threads.
         class Path {
         private:
             std::string path;
 
+            static constexpr uint32_t none = UINT32_MAX;   // no such position, or a path too long to index
+            static constexpr uint32_t inlineSeparators = 8; // deeper paths keep their separators on the heap
+            enum IndexState : uint8_t { unindexed, indexing, indexed };
+
+            struct Index {
+                union {
+                    uint32_t local[inlineSeparators];
+                    uint32_t* heap;
+                } separators;
+                uint32_t separatorCount = 0;
+                uint32_t extention = none;     // position of the dot of the short extention
+                uint32_t longExtention = none; // position of the dot of the long extention
+                std::atomic<uint8_t> state{unindexed}; // the rest is written once by the thread that set indexing
+
+                const uint32_t* separatorData() const noexcept {
+                    return separatorCount > inlineSeparators ? separators.heap : separators.local;
+                }
+                void copyPositions(const Index& other) noexcept {
+                    separators = other.separators;
+                    separatorCount = other.separatorCount;
+                    extention = other.extention;
+                    longExtention = other.longExtention;
+                }
+            };
+            mutable Index index;
+
             void winToUnixPath() {
                 //if windows
-                path = estd::string_util::replace_all(path, "\\", "/");
+                if (std::memchr(path.data(), '\\', path.size()) == nullptr) return; // the common case, vectorized
+                std::replace(path.begin(), path.end(), '\\', '/');
+            }
+
+            // std::filesystem::path::lexically_normal() in one pass over the string, in place and without
+            // allocating: duplicate separators and "." are dropped, ".." removes the component before it, ".." above
+            // the root is dropped, a separator after ".." is removed and an empty result becomes "./"
+            static void normalizeString(std::string& p) noexcept {
+                const size_t n = p.size();
+                const size_t base = !p.empty() && p[0] == '/' ? 1 : 0; // the root separator stays
+                size_t w = base;
+                bool trailing = false;
+                for (size_t r = base; r < n;) {
+                    size_t end = r;
+                    while (end < n && p[end] != '/') end++;
+                    const size_t length = end - r;
+                    const bool separator = end < n;
+                    if (length == 0) {
+                        // duplicate separator
+                    } else if (length == 1 && p[r] == '.') {
+                        trailing = true;
+                    } else if (length == 2 && p[r] == '.' && p[r + 1] == '.') {
+                        size_t last = w;
+                        while (last > base && p[last - 1] != '/') last--;
+                        if (w > base && !(w - last == 2 && p[last] == '.' && p[last + 1] == '.')) {
+                            w = last > base ? last - 1 : base; // drop the previous component
+                            trailing = true;
+                        } else if (base == 0) {
+                            if (w > base) p[w++] = '/';
+                            p[w++] = '.';
+                            p[w++] = '.';
+                        }
+                    } else {
+                        if (w > base) p[w++] = '/';
+                        std::memmove(&p[w], &p[r], length);
+                        w += length;
+                        trailing = separator;
+                    }
+                    r = end + 1;
+                }
+                if (w == base) {
+                    p.assign(base ? "/" : "./");
+                    return;
+                }
+                const bool dotDot = w - base >= 2 && p[w - 1] == '.' && p[w - 2] == '.' &&
+                                    (w - base == 2 || p[w - 3] == '/');
+                if (trailing && !dotDot) p[w++] = '/';
+                p.resize(w);
+            }
+
+            // the index, built now if nobody did yet, nullptr while another thread builds it
+            const Index* getIndex() const noexcept {
+                uint8_t s = index.state.load(std::memory_order_acquire);
+                if (s == indexed) return &index;
+                if (s != unindexed || path.size() >= none) return nullptr;
+                if (!index.state.compare_exchange_strong(s, indexing, std::memory_order_acquire)) {
+                    return s == indexed ? &index : nullptr;
+                }
+                const uint32_t count = uint32_t(std::count(path.begin(), path.end(), '/'));
+                uint32_t* out = index.separators.local;
+                if (count > inlineSeparators) {
+                    out = new (std::nothrow) uint32_t[count];
+                    if (out == nullptr) {
+                        index.state.store(unindexed, std::memory_order_release);
+                        return nullptr;
+                    }
+                    index.separators.heap = out;
+                }
+                for (size_t i = path.find('/'); i != std::string::npos; i = path.find('/', i + 1)) *out++ = uint32_t(i);
+                index.separatorCount = count;
+                const PathView v(path);
+                auto ext = v.splitExtention();
+                auto longExt = v.splitLongExtention();
+                index.extention = ext.second.empty() ? none : uint32_t(ext.first.size());
+                index.longExtention = longExt.second.empty() ? none : uint32_t(longExt.first.size());
+                index.state.store(indexed, std::memory_order_release);
+                return &index;
+            }
+            // called by every mutator, the next query indexes again
+            void unindex() noexcept {
+                bool heap = index.separatorCount > inlineSeparators;
+                if (heap && index.state.load(std::memory_order_relaxed) == indexed) delete[] index.separators.heap;
+                index.state.store(unindexed, std::memory_order_relaxed);
+            }
+            void copyIndex(const Path& p) noexcept {
+                // a heap index is left to the next query, copying it would cost as much as building it
+                if (p.index.state.load(std::memory_order_acquire) != indexed) return;
+                if (p.index.separatorCount > inlineSeparators) return;
+                index.copyPositions(p.index);
+                index.state.store(indexed, std::memory_order_relaxed);
+            }
+            void takeIndex(Path& p) noexcept {
+                if (p.index.state.load(std::memory_order_relaxed) == indexed) {
+                    index.copyPositions(p.index);
+                    index.state.store(indexed, std::memory_order_relaxed);
+                }
+                p.index.state.store(unindexed, std::memory_order_relaxed);
+                p.path.clear();
             }
 
         public:
             Path() noexcept {}
-            Path(const Path& p) = default;
-            Path(Path&& p) = default;
+            Path(const Path& p) : path(p.path) { copyIndex(p); }
+            Path(Path&& p) noexcept : path(std::move(p.path)) { takeIndex(p); }
+            ~Path() { unindex(); }
             Path(std::filesystem::path&& source) {
                 path = source.string();
                 winToUnixPath();
@@ -79,29 +382,53 @@ namespace estd {
                 path = source.string();
                 winToUnixPath();
             }
+            Path(PathView source) {
+                path = source.view();
+                winToUnixPath();
+            }
 
-            Path& operator=(const Path& p) = default;
-            Path& operator=(Path&& p) = default;
+            Path& operator=(const Path& p) {
+                if (this == &p) return *this;
+                unindex();
+                path = p.path;
+                copyIndex(p);
+                return *this;
+            }
+            Path& operator=(Path&& p) noexcept {
+                if (this == &p) return *this;
+                unindex();
+                path = std::move(p.path);
+                takeIndex(p);
+                return *this;
+            }
 
-            bool operator==(Path&& other) const { return path == other.string(); }
-            bool operator==(const Path& other) const { return path == other.string(); }
+            bool operator==(Path&& other) const { return path == other.path; }
+            bool operator==(const Path& other) const { return path == other.path; }
 #if __cplusplus < 202002L
-            bool operator!=(Path&& other) const { return path != other.string(); }
-            bool operator!=(const Path& other) const { return path != other.string(); }
+            bool operator!=(Path&& other) const { return path != other.path; }
+            bool operator!=(const Path& other) const { return path != other.path; }
 #endif
 
             friend Path operator/(const Path& lhs, const Path& rhs) { return Path(lhs.string() + "/" + rhs.string()); }
             friend Path operator+(const Path& lhs, const Path& rhs) { return Path(lhs.string() + rhs.string()); }
-            friend Path& operator/=(Path& lhs, const Path& rhs) { return lhs.path += "/" + rhs.string(), lhs; }
-            friend Path& operator+=(Path& lhs, const Path& rhs) { return lhs.path += rhs.string(), lhs; }
+            friend Path& operator/=(Path& lhs, const Path& rhs) {
+                lhs.path += "/" + rhs.path;
+                lhs.unindex();
+                return lhs;
+            }
+            friend Path& operator+=(Path& lhs, const Path& rhs) {
+                lhs.path += rhs.path;
+                lhs.unindex();
+                return lhs;
+            }
 
-            friend std::ostream& operator<<(std::ostream& stream, Path p) {
-                return stream << "\"" << p.string() << "\"";
+            friend std::ostream& operator<<(std::ostream& stream, const Path& p) {
+                return stream << "\"" << p.path << "\"";
             }
-            friend bool operator<(const Path left, const Path right) { return left.string() < right.string(); }
-            friend bool operator>(const Path left, const Path right) { return left.string() > right.string(); }
-            friend bool operator<=(const Path left, const Path right) { return left.string() <= right.string(); }
-            friend bool operator>=(const Path left, const Path right) { return left.string() >= right.string(); }
+            friend bool operator<(const Path& left, const Path& right) { return left.path < right.path; }
+            friend bool operator>(const Path& left, const Path& right) { return left.path > right.path; }
+            friend bool operator<=(const Path& left, const Path& right) { return left.path <= right.path; }
+            friend bool operator>=(const Path& left, const Path& right) { return left.path >= right.path; }
             // friend bool operator==(const Path left, const Path right) { return left.string() == right.string(); }
             // friend bool operator!=(const Path left, const Path right) { return left.string() != right.string(); }
 
@@ -111,17 +438,24 @@ namespace estd {
 
 
             std::string string() const noexcept { return path; }
+            std::string_view view() const noexcept { return path; }
 
-            Path normalize() {
-                Path tmp = std::filesystem::path(path).lexically_normal();
-                if (tmp == "" || tmp == "." || tmp == "./") { tmp = "./"; }
+            Path normalize() const& {
+                Path tmp = *this;
+                normalizeString(tmp.path);
+                tmp.unindex();
                 return tmp;
             }
+            Path normalize() && {
+                normalizeString(path);
+                unindex();
+                return std::move(*this);
+            }
 
             Path normalizeSafe() = delete; // TODO: Not implemented yet
 
             // tells if this path is a parent of the passed path if(other is a tree in *this) (only for directories)
-            bool contains(Path& other) { // TODO: cover edge cases
+            bool contains(const Path& other) const { // TODO: cover edge cases
                 Path left = Path((*this) / "").normalize();
                 Path right = Path(other / "").normalize();
                 if (left == "./") { return true; }
@@ -129,105 +463,115 @@ namespace estd {
                 return estd::string_util::hasPrefix(right, left);
             }
 
-            bool isFile() { return hasSuffix(); }
-            bool isDirectory() { return !hasSuffix(); }
-            Path addEmptySuffix() { return hasSuffix() ? *this / "" : *this; }
-            Path addEmptyPrefix() { return hasPrefix() ? "" / *this : *this; }
-            Path removeEmptySuffix() { return hasSuffix() ? *this : splitSuffix().first; }
-            Path removeEmptyPrefix() { return hasPrefix() ? *this : splitPrefix().second; }
-            bool hasPrefix() { return splitPrefix().first != ""; }
-            bool hasSuffix() { return splitSuffix().second != ""; }
-            Path getPrefix() { return splitPrefix().first; }
-            Path getSuffix() { return splitSuffix().second; }
-            bool hasAntiPrefix() { return splitPrefix().second != ""; }
-            bool hasAntiSuffix() { return splitSuffix().first != ""; }
-            Path getAntiPrefix() { return splitPrefix().second; }
-            Path getAntiSuffix() { return splitSuffix().first; }
-            Path replaceSuffix(Path s) { return splitSuffix().first / s; }
-            Path replacePrefix(Path s) { return s / splitPrefix().second; }
-
-            bool hasExtention() { return splitLongExtention().second != ""; }
-            std::string getExtention() { return splitExtention().second; }
-            Path replaceExtention(std::string s) { return splitExtention().first + "." + s; }
-
-            std::string getLongExtention() { return splitLongExtention().second; }
-            Path replaceLongExtention(std::string s) { return splitLongExtention().first + "." + s; }
-
-
-            std::pair<Path, std::string> splitExtention() {
-                size_t mid_pos = 0;
-                std::string source = getSuffix();
-                std::string psL = "";
-                std::string psR = "";
-                bool isHidden = false;
-                if (isDirectory()) return {string(), ""};
-                if (estd::string_util::hasPrefix(source, ".")) {
-                    source = source.substr(1);
-                    isHidden = true;
-                }
-                if ((mid_pos = source.rfind(".")) != std::string::npos) {
-                    psL = source.substr(0, mid_pos);
-                    psR = source.substr(mid_pos);
-                } else {
-                    return {string(), ""};
-                }
-                if (isHidden) psL = "." + psL;
-                if (estd::string_util::contains(string(), "/")) psL = getAntiSuffix() / psL;
-                return {psL, psR};
+            bool isFile() const { return hasSuffix(); }
+            bool isDirectory() const { return !hasSuffix(); }
+            Path addEmptySuffix() const { return hasSuffix() ? *this / "" : *this; }
+            Path addEmptyPrefix() const { return hasPrefix() ? "" / *this : *this; }
+            Path removeEmptySuffix() const { return hasSuffix() ? *this : splitSuffix().first; }
+            Path removeEmptyPrefix() const { return hasPrefix() ? *this : splitPrefix().second; }
+            bool hasPrefix() const { return !viewPrefix().first.empty(); }
+            bool hasSuffix() const { return !viewSuffix().second.empty(); }
+            Path getPrefix() const { return viewPrefix().first; }
+            Path getSuffix() const { return viewSuffix().second; }
+            bool hasAntiPrefix() const { return !viewPrefix().second.empty(); }
+            bool hasAntiSuffix() const { return !viewSuffix().first.empty(); }
+            Path getAntiPrefix() const { return viewPrefix().second; }
+            Path getAntiSuffix() const { return viewSuffix().first; }
+            Path replaceSuffix(Path s) const { return splitSuffix().first / s; }
+            Path replacePrefix(Path s) const { return s / splitPrefix().second; }
+
+            bool hasExtention() const { return !viewLongExtention().second.empty(); }
+            std::string getExtention() const { return std::string(viewExtention().second); }
+            Path replaceExtention(std::string s) const { return splitExtention().first + "." + s; }
+
+            std::string getLongExtention() const { return std::string(viewLongExtention().second); }
+            Path replaceLongExtention(std::string s) const { return splitLongExtention().first + "." + s; }
+
+
+            std::pair<Path, std::string> splitExtention() const {
+                auto split = viewExtention();
+                return {split.first, std::string(split.second)};
             }
 
+            std::pair<Path, std::string> splitLongExtention() const {
+                auto split = viewLongExtention();
+                return {split.first, std::string(split.second)};
+            }
 
-            std::pair<Path, std::string> splitLongExtention() {
-                size_t mid_pos = 0;
-                std::string source = getSuffix();
-                std::string psL = "";
-                std::string psR = "";
-                bool isHidden = false;
-                if (isDirectory()) return {string(), ""};
-                if (estd::string_util::hasPrefix(source, ".")) {
-                    source = source.substr(1);
-                    isHidden = true;
-                }
-                if ((mid_pos = source.find(".")) != std::string::npos) {
-                    psL = source.substr(0, mid_pos);
-                    psR = source.substr(mid_pos);
-                } else {
-                    return {string(), ""};
-                }
-                if (isHidden) psL = "." + psL;
-                if (estd::string_util::contains(string(), "/")) psL = getAntiSuffix() / psL;
-                return {psL, psR};
+            std::pair<Path, Path> splitPrefix() const {
+                auto split = viewPrefix();
+                return {split.first, split.second};
             }
 
-            std::pair<Path, Path> splitPrefix() {
-                size_t mid_pos = 0;
-                std::string source = string();
-                std::string psL = "";
-                std::string psR = "";
-                if ((mid_pos = source.find("/")) != std::string::npos) {
-                    psL = source.substr(0, mid_pos);
-                    psR = source.substr(mid_pos + 1);
-                } else {
-                    return {source, ""};
-                }
-                return {psL, psR};
+            std::pair<Path, Path> splitSuffix() const {
+                auto split = viewSuffix();
+                return {split.first, split.second};
             }
 
-            std::pair<Path, Path> splitSuffix() {
-                size_t mid_pos = 0;
-                std::string source = string();
-                std::string psL = "";
-                std::string psR = "";
-                if ((mid_pos = source.rfind("/")) != std::string::npos) {
-                    psL = source.substr(0, mid_pos);
-                    psR = source.substr(mid_pos + 1);
-                } else {
-                    return {"", source};
+            // same splits as above, as views into this path (valid until it is modified), O(1)
+            std::pair<PathView, std::string_view> viewExtention() const {
+                const Index* idx = getIndex();
+                if (idx == nullptr) return PathView(path).splitExtention();
+                if (idx->extention == none) return {*this, ""};
+                return {view().substr(0, idx->extention), view().substr(idx->extention)};
+            }
+            std::pair<PathView, std::string_view> viewLongExtention() const {
+                const Index* idx = getIndex();
+                if (idx == nullptr) return PathView(path).splitLongExtention();
+                if (idx->longExtention == none) return {*this, ""};
+                return {view().substr(0, idx->longExtention), view().substr(idx->longExtention)};
+            }
+            std::pair<PathView, PathView> viewPrefix() const {
+                const Index* idx = getIndex();
+                if (idx == nullptr) return PathView(path).splitPrefix();
+                if (idx->separatorCount == 0) return {*this, PathView()};
+                size_t pos = idx->separatorData()[0];
+                return {view().substr(0, pos), view().substr(pos + 1)};
+            }
+            std::pair<PathView, PathView> viewSuffix() const {
+                const Index* idx = getIndex();
+                if (idx == nullptr) return PathView(path).splitSuffix();
+                if (idx->separatorCount == 0) return {PathView(), *this};
+                size_t pos = idx->separatorData()[idx->separatorCount - 1];
+                return {view().substr(0, pos), view().substr(pos + 1)};
+            }
+
+            // components between separators, "a/b/" has 3 components: "a", "b" and ""
+            size_t componentCount() const noexcept {
+                const Index* idx = getIndex();
+                if (idx == nullptr) return size_t(std::count(path.begin(), path.end(), '/')) + 1;
+                return size_t(idx->separatorCount) + 1;
+            }
+            PathView componentAt(size_t i) const {
+                const Index* idx = getIndex();
+                if (idx == nullptr) {
+                    size_t first = 0;
+                    for (; i > 0; i--) {
+                        first = path.find('/', first);
+                        if (first == std::string::npos) throw std::out_of_range("Path::componentAt index out of range");
+                        first++;
+                    }
+                    return view().substr(first, std::min(path.find('/', first), path.size()) - first);
+                }
+                if (i > idx->separatorCount) throw std::out_of_range("Path::componentAt index out of range");
+                const uint32_t* separators = idx->separatorData();
+                size_t first = i == 0 ? 0 : separators[i - 1] + 1;
+                size_t last = i == idx->separatorCount ? path.size() : separators[i];
+                return view().substr(first, last - first);
+            }
+            // the position of every separator into out (its capacity is reused), component i lies between
+            // out[i - 1] + 1 and out[i] (the start and the end of the path at the ends)
+            void separators(std::vector<size_t>& out) const {
+                out.clear();
+                if (const Index* idx = getIndex()) {
+                    out.assign(idx->separatorData(), idx->separatorData() + idx->separatorCount);
+                    return;
                 }
-                return {psL, psR};
+                for (size_t i = path.find('/'); i != std::string::npos; i = path.find('/', i + 1)) out.push_back(i);
             }
+            PathView::Components components() const noexcept { return PathView(*this).components(); }
 
-            estd::stack_ptr<Path> replacePrefix(Path from, Path to) {
+            estd::stack_ptr<Path> replacePrefix(Path from, Path to) const {
                 Path path = *this;
 
                 // path = ("" / path).normalize();
@@ -263,424 +607,4426 @@ namespace estd {
             }
         };
 
-        namespace {
-            void throwError(std::string description, Path* dir1 = nullptr, Path* dir2 = nullptr) {
-                if (dir2 != nullptr && dir1 != nullptr) {
-                    throw estd::files::FileException(
-                        std::string("filesystem error: ") + description + " [" + dir1->string() + "]" + " [" +
-                        dir2->string() + "]"
-                    );
-                } else if (dir1 != nullptr) {
-                    throw estd::files::FileException(
-                        std::string("filesystem error: ") + description + " [" + dir1->string() + "]"
-                    );
-                } else {
-                    throw estd::files::FileException(std::string("filesystem error: ") + description);
-                }
-            };
-        } // namespace
-
-        inline bool isDirectory(Path p);
-        inline Path followSoftLink(Path p);
-        inline bool isSoftLink(Path p);
-        inline bool isBlockFile(Path p);
-        inline bool isCharacterFile(Path p);
-        inline bool isEmptry(Path p);
-        inline bool isFIFO(Path p);
-        inline bool isOther(Path p);
-        inline bool isFile(Path p);
-
-        enum CopyOptions : uint64_t {
-            none = 0,
-
-            skipExisting = 1 << 0,
-            overwriteExisting = 1 << 1,
-            updateExisting = 1 << 2,
+        inline PathView::PathView(const Path& source) noexcept : path(source.view()) {}
 
-            recursive = 1 << 3,
+        // Path::replacePrefix(from, to) for many paths with the same mapping, from and to are normalized once.
+        // Normalized inputs (what the directory iterators return below a normalized root) are rewritten by
+        // comparing and copying the text, anything else goes through replacePrefix, the results are the same.
+        class PrefixRewriter {
+        private:
+            Path iFrom, iTo;          // as passed
+            std::string iFromPrefix;  // normalized with a trailing slash
+            std::string iToPrefix;    // normalized with a trailing slash, empty for the current directory
+            bool iMatchesAll = false; // from is the current directory, every relative path matches
 
-            softLinksAsCopies = 1 << 4,
-            skipSoftLinks = 1 << 5,
-            directoriesOnly = 1 << 6,
+            // what lexically_normal returns: no empty or "." components and ".." only at the front
+            static bool isNormal(std::string_view p) noexcept {
+                if (p.empty()) return false;
+                size_t i = p[0] == '/' ? 1 : 0;
+                bool leading = true;
+                while (i < p.size()) {
+                    size_t end = p.find('/', i);
+                    if (end == std::string_view::npos) end = p.size();
+                    std::string_view c = p.substr(i, end - i);
+                    leading = leading && c == "..";
+                    if (c.empty() || c == "." || (c == ".." && !leading)) return false;
+                    i = end + 1;
+                }
+                return true;
+            }
 
-            copyAsSoftLinks = 1 << 7,
-            copyAsHardLinks = 1 << 8,
-            overwriteReadonly = 1 << 9
-        };
+            bool replacePrefix(PathView p, std::string& out) const {
+                estd::stack_ptr<Path> result = Path(p).replacePrefix(iFrom, iTo);
+                if (!result) return false;
+                out = result.value().string();
+                return true;
+            }
 
-        class DirectoryEntry : public std::filesystem::directory_entry {
         public:
-            using std::filesystem::directory_entry::directory_entry;
-            Path path() const noexcept { return std::filesystem::directory_entry::path(); }
-            operator Path() const noexcept { return std::filesystem::directory_entry::path(); }
-            void assign(const Path& p) { std::filesystem::directory_entry::assign(p); }
-        };
-
-        class DirectoryIterator : public std::filesystem::directory_iterator {
-            mutable DirectoryEntry e;
+            PrefixRewriter(const Path& from, const Path& to) : iFrom(from), iTo(to) {
+                // the same mapping replacePrefix builds on every call
+                bool fromIsDir = !from.hasSuffix();
+                bool toIsDir = !to.hasSuffix();
+                Path f = (from / "").normalize();
+                Path t = (to / "").normalize();
+                if (toIsDir && !fromIsDir) { // from is a file && to is a dir
+                    t = t.replaceSuffix(f.splitSuffix().first.getSuffix());
+                    t = (t / "").normalize();
+                }
+                iMatchesAll = f == "" || f == "." || f == "./";
+                iFromPrefix = f.string();
+                iToPrefix = t == "./" ? "" : t.string();
+                if (!iToPrefix.empty() && iToPrefix.back() != '/') iToPrefix += '/';
+            }
 
-        public:
-            using std::filesystem::directory_iterator::directory_iterator;
-            friend inline DirectoryIterator begin(DirectoryIterator iter) noexcept { return iter; }
-            friend inline DirectoryIterator end(DirectoryIterator) noexcept { return DirectoryIterator(); }
-            const DirectoryEntry& operator*() const noexcept {
-                e = DirectoryEntry(std::filesystem::directory_iterator::operator*());
+            const Path& from() const noexcept { return iFrom; }
+            const Path& to() const noexcept { return iTo; }
 
-                if (e.is_directory()) {
-                    e.assign(e.path().addEmptySuffix());
-                    return e;
-                } else if (e.is_symlink()) {
-                    if (isDirectory(e.path())) {
-                        e.assign(e.path().addEmptySuffix());
-                        return e;
+            // writes the rewritten path into out (its capacity is reused), returns false and leaves out alone if
+            // p is not below from
+            bool rewrite(PathView p, std::string& out) const {
+                std::string_view v = p.view();
+                if (!isNormal(v) || (iMatchesAll && v[0] == '/')) return replacePrefix(p, out);
+                const bool directory = v.back() == '/';
+                std::string_view rest = v;
+                if (!iMatchesAll) {
+                    const size_t n = iFromPrefix.size();
+                    if (v.size() >= n) {
+                        if (v.compare(0, n, iFromPrefix) != 0) return false;
+                        rest = v.substr(n);
+                    } else if (directory || v.size() + 1 != n || iFromPrefix.compare(0, v.size(), v) != 0) {
+                        return false;
                     } else {
-                        e.assign(e.path().removeEmptySuffix());
-                        return e;
+                        rest = {}; // the file from itself
                     }
                 }
-                e.assign(Path(e.path()).removeEmptySuffix());
-                return e;
-            }
-            const DirectoryEntry* operator->() const noexcept { return &*(*this); }
-            DirectoryIterator& operator++() {
-                std::filesystem::directory_iterator::operator++();
-                return *this;
-            }
-            DirectoryIterator& increment(std::error_code& ec) {
-                std::filesystem::directory_iterator::increment(ec);
-                return *this;
+                if (rest.substr(0, 2) == "..") return replacePrefix(p, out); // would have to be collapsed
+                out.assign(iToPrefix);
+                out.append(rest.data(), rest.size());
+                if (!directory && !out.empty() && out.back() == '/') out.pop_back();
+                if (out.empty()) out = "./";
+                return true;
             }
 
-            DirectoryIterator operator++(int) {
-                DirectoryIterator old{**this};
-                ++*this;
-                return old;
+            estd::stack_ptr<Path> rewrite(PathView p) const {
+                std::string out;
+                if (!rewrite(p, out)) return nullptr;
+                return Path(std::move(out));
             }
-        };
-        class RecursiveDirectoryIterator : public std::filesystem::recursive_directory_iterator {
-            mutable DirectoryEntry e;
 
-        public:
-            using std::filesystem::recursive_directory_iterator::recursive_directory_iterator;
-            friend inline RecursiveDirectoryIterator begin(RecursiveDirectoryIterator iter) noexcept { return iter; }
-            friend inline RecursiveDirectoryIterator end(RecursiveDirectoryIterator) noexcept {
-                return RecursiveDirectoryIterator();
-            }
-            const DirectoryEntry& operator*() const noexcept {
-                e = DirectoryEntry(std::filesystem::recursive_directory_iterator::operator*());
-                if (e.is_directory()) {
-                    e.assign(e.path().addEmptySuffix());
-                    return e;
-                } else if (e.is_symlink()) {
-                    if (isDirectory(e.path())) {
-                        e.assign(e.path().addEmptySuffix());
-                        return e;
+            // rewrites a batch into out (resized to match), paths that are not below from are left empty,
+            // returns how many were rewritten
+            size_t rewrite(const std::vector<Path>& paths, std::vector<Path>& out) const {
+                out.resize(paths.size());
+                size_t count = 0;
+                std::string buffer;
+                for (size_t i = 0; i < paths.size(); i++) {
+                    if (rewrite(paths[i], buffer)) {
+                        out[i] = Path(buffer);
+                        count++;
                     } else {
-                        e.assign(e.path().removeEmptySuffix());
-                        return e;
+                        out[i] = Path();
                     }
                 }
-                e.assign(Path(e.path()).removeEmptySuffix());
-                return e;
-            }
-            const DirectoryEntry* operator->() const noexcept { return &*(*this); }
-            RecursiveDirectoryIterator& operator++() {
-                return std::filesystem::recursive_directory_iterator::operator++(), *this;
-            }
-            RecursiveDirectoryIterator& increment(std::error_code& ec) {
-                return std::filesystem::recursive_directory_iterator::increment(ec), *this;
-            }
-            RecursiveDirectoryIterator operator++(int) {
-                RecursiveDirectoryIterator old{**this};
-                ++*this;
-                return old;
+                return count;
             }
         };
 
-        typedef std::filesystem::perms Permissions;
-
-        using FileTime = std::filesystem::file_time_type;
-        inline Permissions getPermissions(Path& p) { return std::filesystem::status(p).permissions(); }
+        // Map from paths to T stored by path component in a prefix compressed tree: a chain of components without
+        // branches is one node. Insert, find and the prefix queries are O(depth) and only allocate when a path
+        // contains "..". "a/b" and "a/b/" are the same key, "./" is the parent of every relative path and "/" of
+        // every absolute one. Iteration is in component order, a directory before its contents.
         template <class T>
-        inline void setPermissions(Path& path, T perm) {
-            std::filesystem::permissions(path, Permissions(perm));
-        }
-        inline Path currentPath() { return std::filesystem::current_path(); }
-        inline void copy(Path from, Path to, const uint64_t opt = CopyOptions::recursive);
+        class PathTrie {
+        public:
+            using value_type = std::pair<const Path, T>;
 
-        inline bool exists(Path p) {
-            return std::filesystem::exists(p) || std::filesystem::is_symlink(p);
-        } // standards version returns false on broken symlink if symlink exists (strange)
-        inline uintmax_t remove(Path p) { return std::filesystem::remove_all(p); }
-        inline bool isDirectory(Path p) { return std::filesystem::is_directory(p); }
-        inline Path followSoftLink(Path p) { return std::filesystem::read_symlink(p); }
-        inline bool isSoftLink(Path p) { return std::filesystem::is_symlink(p); }
-        inline bool isBlockFile(Path p) { return std::filesystem::is_block_file(p); }
-        inline bool isCharacterFile(Path p) { return std::filesystem::is_character_file(p); }
-        inline bool isEmptry(Path p) { return std::filesystem::is_empty(p); }
-        inline bool isFIFO(Path p) { return std::filesystem::is_fifo(p); }
-        inline bool isOther(Path p) { return std::filesystem::is_other(p); }
-        inline bool isFile(Path p) { return std::filesystem::is_regular_file(p); }
-
-        // returns if it is a directory or a softlink to a directory
-        inline bool isSoftDirectory(Path p) {
-            std::function<bool(Path, std::set<Path>&)> iSD;
-            iSD = [&iSD](Path p, std::set<Path>& visited) {
-                if (visited.count(p)) return false;
-                visited.insert(p);
-
-                if (isFile(p)) return true;
-                if (isSoftLink(p)) {
-                    Path link = followSoftLink(p);
-                    if (exists(link)) return iSD(p, visited);
-                    return link.hasSuffix();
-                }
-                return false;
+        private:
+            struct Node {
+                std::string label; // components from the parent to this node, joined by '/'
+                std::map<std::string, std::unique_ptr<Node>, std::less<>> children; // by first label component
+                std::unique_ptr<value_type> entry;
             };
-            std::set<Path> visited;
-            return iSD(p, visited);
-        }
+            Node iRoot;
+            size_t iSize = 0;
 
-        inline bool isSoftFile(Path p) {
-            std::function<bool(Path, std::set<Path>&)> iSF;
-            iSF = [&iSF](Path p, std::set<Path>& visited) {
-                if (visited.count(p)) return false;
-                visited.insert(p);
+            // the components of a path after a first "" for absolute and "." for relative paths, the root node has
+            // no entry. Empty and "." components are skipped
+            class Cursor {
+            private:
+                std::string_view rest;
+                bool first = true;
 
-                if (isFile(p)) return true;
-                if (isSoftLink(p)) {
-                    Path link = followSoftLink(p);
-                    if (exists(link)) return iSF(p, visited);
-                    return link.hasSuffix();
+            public:
+                explicit Cursor(std::string_view p) noexcept : rest(p) {}
+                bool next(std::string_view& c) noexcept {
+                    if (first) {
+                        first = false;
+                        c = !rest.empty() && rest[0] == '/' ? std::string_view("", 0) : std::string_view(".", 1);
+                        return true;
+                    }
+                    while (true) {
+                        while (!rest.empty() && rest[0] == '/') rest.remove_prefix(1);
+                        if (rest.empty()) return false;
+                        c = rest.substr(0, rest.find('/'));
+                        rest.remove_prefix(c.size());
+                        if (c != ".") return true;
+                    }
                 }
-                return false;
             };
-            std::set<Path> visited;
-            return iSF(p, visited);
-        }
 
-        inline bool isSocket(Path p) { return std::filesystem::is_socket(p); }
-        inline void createHardLink(Path from, Path to) { return std::filesystem::create_hard_link(from, to); }
-        inline void createSoftLink(Path from, Path to) {
-            Path linkroot = to.removeEmptySuffix().splitSuffix().first;
-            to = to.removeEmptySuffix();
-            from = std::filesystem::relative(from, linkroot);
-            std::filesystem::create_symlink(from, to);
-        }
-        //from path will be relative (the way it is in the OS)
-        inline void createSoftLinkRelative(Path from, Path to) {
-            to = to.removeEmptySuffix();
-            std::filesystem::create_symlink(from, to);
-        }
+            static bool needsNormalize(std::string_view p) noexcept { return p.find("..") != std::string_view::npos; }
 
-        inline void createDirectories(Path p) { std::filesystem::create_directories(p); }
-        inline void createDirectory(Path p) { std::filesystem::create_directory(p); }
+            // matches the label components after the first one, returns the position of the separator before the
+            // first mismatching component or npos if the whole label matched, the cursor stops before the mismatch
+            static size_t matchLabel(std::string_view label, Cursor& cursor) noexcept {
+                for (size_t pos = label.find('/'); pos != std::string_view::npos;) {
+                    const size_t end = label.find('/', pos + 1);
+                    const size_t length = end == std::string_view::npos ? end : end - pos - 1;
+                    std::string_view expected = label.substr(pos + 1, length);
+                    Cursor before = cursor;
+                    std::string_view c;
+                    if (!cursor.next(c) || c != expected) {
+                        cursor = before;
+                        return pos;
+                    }
+                    pos = end;
+                }
+                return std::string_view::npos;
+            }
 
-        inline FileTime getModificationTime(Path p) { return std::filesystem::last_write_time(p); }
-        inline void setModificationTime(Path p, FileTime n) { std::filesystem::last_write_time(p, n); }
+            // calls f(node) for the root and every node whose label the path matches completely, returns the node
+            // of the path itself or nullptr
+            template <class F>
+            const Node* walk(std::string_view p, const F& f) const {
+                Cursor cursor(p);
+                const Node* node = &iRoot;
+                if (f(*node)) return node;
+                std::string_view c;
+                while (cursor.next(c)) {
+                    auto it = node->children.find(c);
+                    if (it == node->children.end()) return nullptr;
+                    node = it->second.get();
+                    if (matchLabel(node->label, cursor) != std::string_view::npos) return nullptr;
+                    if (f(*node)) return node;
+                }
+                return node;
+            }
 
-        inline void copySoftLink(Path from, Path to, const uint64_t opt = CopyOptions::none) {
-            if (!isSoftLink(from)) throwError("copySoftLink: not a softlink", &from);
-            if (opt & CopyOptions::updateExisting) {
-                if (exists(to)) {
-                    auto newTime = getModificationTime(from);
-                    auto oldTime = getModificationTime(to);
-                    if (newTime > oldTime) {
-                        remove(to);
-                        std::filesystem::copy_symlink(from, to);
+            // the node whose subtree holds exactly the stored paths at or below p
+            const Node* subtree(std::string_view p) const {
+                Cursor cursor(p);
+                const Node* node = &iRoot;
+                std::string_view c;
+                while (cursor.next(c)) {
+                    auto it = node->children.find(c);
+                    if (it == node->children.end()) return nullptr;
+                    node = it->second.get();
+                    if (matchLabel(node->label, cursor) != std::string_view::npos) {
+                        std::string_view rest;
+                        return cursor.next(rest) ? nullptr : node; // p ends inside the label
                     }
-                } else {
-                    std::filesystem::copy_symlink(from, to);
                 }
-            } else if (opt & CopyOptions::overwriteExisting) {
-                if (exists(to)) remove(to);
-                std::filesystem::copy_symlink(from, to);
-            } else if (opt & CopyOptions::skipExisting) {
-                if (!exists(to)) std::filesystem::copy_symlink(from, to);
-            } else {
-                if (!exists(to)) {
-                    std::filesystem::copy_symlink(from, to);
-                } else {
-                    throwError("copySoftLink cannot copy, entry exists", &to);
+                return node;
+            }
+
+            Node& insertNode(std::string_view p) {
+                Cursor cursor(p);
+                Node* node = &iRoot;
+                std::string_view c;
+                while (cursor.next(c)) {
+                    auto it = node->children.find(c);
+                    if (it == node->children.end()) {
+                        auto child = std::make_unique<Node>();
+                        child->label = c;
+                        while (cursor.next(c)) child->label.append("/").append(c);
+                        Node* created = child.get();
+                        const std::string key(child->label.substr(0, child->label.find('/')));
+                        node->children.emplace(key, std::move(child));
+                        return *created;
+                    }
+                    const size_t split = matchLabel(it->second->label, cursor);
+                    if (split != std::string_view::npos) { // the path leaves the label, split the node there
+                        auto middle = std::make_unique<Node>();
+                        middle->label = it->second->label.substr(0, split);
+                        it->second->label.erase(0, split + 1);
+                        const std::string key(it->second->label.substr(0, it->second->label.find('/')));
+                        middle->children.emplace(key, std::move(it->second));
+                        it->second = std::move(middle);
+                    }
+                    node = it->second.get();
                 }
+                return *node;
             }
-        }
-        inline void copyDirectory(Path from, Path to, const uint64_t opt = CopyOptions::recursive) {
-            if (from.isFile()) {
-                throwError("copyDirectory cannot copy, from is not a directory", &from);
-            } else if (to.isFile()) {
-                throwError("copyDirectory cannot copy, to is not a directory", &to);
+
+            bool eraseBelow(Node& node, Cursor cursor) {
+                std::string_view c;
+                if (!cursor.next(c)) {
+                    if (!node.entry) return false;
+                    node.entry.reset();
+                    return true;
+                }
+                auto it = node.children.find(c);
+                if (it == node.children.end()) return false;
+                Node& child = *it->second;
+                if (matchLabel(child.label, cursor) != std::string_view::npos || !eraseBelow(child, cursor)) {
+                    return false;
+                }
+                if (!child.entry && child.children.empty()) {
+                    node.children.erase(it);
+                } else if (!child.entry && child.children.size() == 1) { // merge the chain again
+                    std::unique_ptr<Node> only = std::move(child.children.begin()->second);
+                    only->label = child.label + "/" + only->label;
+                    it->second = std::move(only);
+                }
+                return true;
             }
 
-            if (!exists(from)) throwError("copyDirectory trying to copy a directory that does not exist", &from);
-            if (!isDirectory(from)) throwError("copyDirectory trying to copy a file", &from);
+            template <class N, class F>
+            static void visit(N& node, const F& f) {
+                if (node.entry) f(*node.entry);
+                for (auto& child : node.children) visit(*child.second, f);
+            }
 
-            if (exists(to) && !isDirectory(to)) { throwError("copyDirectory trying to copy to a file", &to); }
+        public:
+            PathTrie() = default;
+            PathTrie(PathTrie&&) noexcept = default;
+            PathTrie& operator=(PathTrie&&) noexcept = default;
 
+            size_t size() const noexcept { return iSize; }
+            bool empty() const noexcept { return iSize == 0; }
+            void clear() {
+                iRoot = Node();
+                iSize = 0;
+            }
+
+            // inserts if p is not stored yet, returns the entry and whether it was inserted
+            std::pair<value_type*, bool> insert(PathView p, T value) {
+                Path key = Path(p).normalize();
+                Node& node = insertNode(key.view());
+                if (node.entry) return {node.entry.get(), false};
+                node.entry = std::make_unique<value_type>(std::move(key), std::move(value));
+                iSize++;
+                return {node.entry.get(), true};
+            }
+            T& operator[](PathView p) { return insert(p, T()).first->second; }
+
+            const value_type* find(PathView p) const {
+                if (needsNormalize(p.view())) return find(Path(p).normalize());
+                const Node* node = walk(p.view(), [](const Node&) { return false; });
+                return node ? node->entry.get() : nullptr;
+            }
+            value_type* find(PathView p) { return const_cast<value_type*>(std::as_const(*this).find(p)); }
+            bool contains(PathView p) const { return find(p) != nullptr; }
+
+            bool erase(PathView p) {
+                if (needsNormalize(p.view())) return erase(Path(p).normalize());
+                if (!eraseBelow(iRoot, Cursor(p.view()))) return false;
+                iSize--;
+                return true;
+            }
+
+            // the deepest stored path that is p or one of its parents ("which root contains p")
+            const value_type* longestPrefixOf(PathView p) const {
+                if (needsNormalize(p.view())) return longestPrefixOf(Path(p).normalize());
+                const value_type* found = nullptr;
+                walk(p.view(), [&](const Node& n) {
+                    if (n.entry) found = n.entry.get();
+                    return false;
+                });
+                return found;
+            }
+            // a stored path is p or one of its parents, stops at the first one
+            bool hasPrefixOf(PathView p) const {
+                if (needsNormalize(p.view())) return hasPrefixOf(Path(p).normalize());
+                bool found = false;
+                walk(p.view(), [&](const Node& n) { return found = found || n.entry != nullptr; });
+                return found;
+            }
+
+            // calls f(value_type&) for every entry in order
+            template <class F>
+            void forEach(const F& f) {
+                visit(iRoot, f);
+            }
+            template <class F>
+            void forEach(const F& f) const {
+                visit(iRoot, f);
+            }
+            // calls f(const value_type&) for p and every stored path below it, in order
+            template <class F>
+            void forEachUnder(PathView p, const F& f) const {
+                if (needsNormalize(p.view())) return forEachUnder(Path(p).normalize(), f);
+                if (const Node* node = subtree(p.view())) visit(*node, f);
+            }
+        };
+
+        // set of paths with the prefix queries of PathTrie
+        class PathSet {
+        private:
+            struct Empty {};
+            PathTrie<Empty> iTrie;
+
+        public:
+            PathSet() = default;
+            PathSet(std::initializer_list<PathView> paths) {
+                for (PathView p : paths) insert(p);
+            }
+
+            size_t size() const noexcept { return iTrie.size(); }
+            bool empty() const noexcept { return iTrie.empty(); }
+            void clear() { iTrie.clear(); }
+            bool insert(PathView p) { return iTrie.insert(p, Empty()).second; }
+            bool erase(PathView p) { return iTrie.erase(p); }
+            bool contains(PathView p) const { return iTrie.contains(p); }
+
+            // the deepest stored path that is p or one of its parents, nullptr if there is none
+            const Path* longestPrefixOf(PathView p) const {
+                auto e = iTrie.longestPrefixOf(p);
+                return e ? &e->first : nullptr;
+            }
+            bool hasPrefixOf(PathView p) const { return iTrie.hasPrefixOf(p); }
+
+            template <class F>
+            void forEach(const F& f) const {
+                iTrie.forEach([&](const auto& e) { f(e.first); });
+            }
+            template <class F>
+            void forEachUnder(PathView p, const F& f) const {
+                iTrie.forEachUnder(p, [&](const auto& e) { f(e.first); });
+            }
+            std::vector<Path> paths() const {
+                std::vector<Path> result;
+                result.reserve(size());
+                forEach([&](const Path& p) { result.push_back(p); });
+                return result;
+            }
+        };
+
+        namespace {
+            void throwError(std::string description, const Path* dir1 = nullptr, const Path* dir2 = nullptr) {
+                if (dir2 != nullptr && dir1 != nullptr) {
+                    throw estd::files::FileException(
+                        std::string("filesystem error: ") + description + " [" + dir1->string() + "]" + " [" +
+                        dir2->string() + "]"
+                    );
+                } else if (dir1 != nullptr) {
+                    throw estd::files::FileException(
+                        std::string("filesystem error: ") + description + " [" + dir1->string() + "]"
+                    );
+                } else {
+                    throw estd::files::FileException(std::string("filesystem error: ") + description);
+                }
+            };
+        } // namespace
+
+        // Work stealing thread pool, every worker owns a deque, tasks submitted from a worker go to its own deque
+        // (LIFO, depth first) and idle workers steal from the front of the others (FIFO, breadth first).
+        // Submitting and finishing tasks only touch atomics, the pool mutex is taken to sleep and to wake sleepers.
+        class WorkStealingPool {
+        private:
+            struct Queue {
+                std::mutex m;
+                std::deque<std::function<void()>> tasks;
+            };
+            std::vector<std::unique_ptr<Queue>> queues;
+            std::vector<std::thread> workers;
+            std::mutex m; // guards stopping, sleeping only changes under it
+            std::condition_variable hasWork;
+            std::condition_variable isIdle;
+            std::atomic<size_t> queued{0};   // tasks sitting in queues, changed under the lock of the queue
+            std::atomic<size_t> pending{0};  // tasks submitted and not yet finished
+            std::atomic<size_t> sleeping{0}; // workers waiting for hasWork
+            bool stopping = false;
+            std::atomic<size_t> nextQueue{0};
+
+            inline static thread_local WorkStealingPool* owner = nullptr;
+            inline static thread_local size_t self = 0;
+
+            bool pop(size_t id, std::function<void()>& task) {
+                for (size_t i = 0; i < queues.size(); i++) {
+                    Queue& q = *queues[(id + i) % queues.size()];
+                    std::lock_guard<std::mutex> lk(q.m);
+                    if (q.tasks.empty()) continue;
+                    queued--;
+                    if (i == 0) {
+                        task = std::move(q.tasks.back());
+                        q.tasks.pop_back();
+                    } else {
+                        task = std::move(q.tasks.front());
+                        q.tasks.pop_front();
+                    }
+                    return true;
+                }
+                return false;
+            }
+
+            void work(size_t id) {
+                owner = this;
+                self = id;
+                std::function<void()> task;
+                while (true) {
+                    if (!pop(id, task)) {
+                        // submit() reads sleeping after counting its task, so one of the two sees the other
+                        std::unique_lock<std::mutex> lk(m);
+                        sleeping++;
+                        hasWork.wait(lk, [&] { return stopping || queued > 0; });
+                        sleeping--;
+                        if (queued == 0) return; // stopping and drained
+                        continue;
+                    }
+                    try {
+                        task();
+                    } catch (...) {} // tasks report their own errors
+                    task = nullptr;
+                    if (--pending == 0) {
+                        std::lock_guard<std::mutex> lk(m); // wait() checks pending under the lock
+                        isIdle.notify_all();
+                    }
+                }
+            }
+
+        public:
+            WorkStealingPool(size_t threads = 0) {
+                if (threads == 0) threads = std::thread::hardware_concurrency();
+                if (threads == 0) threads = 1;
+                for (size_t i = 0; i < threads; i++) queues.emplace_back(new Queue());
+                for (size_t i = 0; i < threads; i++) workers.emplace_back([this, i] { work(i); });
+            }
+            WorkStealingPool(const WorkStealingPool&) = delete;
+            WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+            ~WorkStealingPool() {
+                {
+                    std::lock_guard<std::mutex> lk(m);
+                    stopping = true;
+                }
+                hasWork.notify_all();
+                for (auto& w : workers) w.join();
+            }
+
+            size_t size() const { return workers.size(); }
+
+            void submit(std::function<void()> task) {
+                size_t id = owner == this ? self : nextQueue++ % queues.size();
+                pending++;
+                {
+                    std::lock_guard<std::mutex> lk(queues[id]->m);
+                    queues[id]->tasks.push_back(std::move(task));
+                    queued++;
+                }
+                if (sleeping > 0) {
+                    { std::lock_guard<std::mutex> lk(m); } // the sleeper is either waiting or saw the task
+                    hasWork.notify_one();
+                }
+            }
+
+            // blocks until every submitted task (including the ones submitted by tasks) is done,
+            // must not be called from inside a task
+            void wait() {
+                std::unique_lock<std::mutex> lk(m);
+                isIdle.wait(lk, [&] { return pending == 0; });
+            }
+        };
+
+#ifdef __linux__
+        // owns a raw file descriptor, closes it on destruction
+        class FileDescriptor {
+        private:
+            int fd = -1;
+
+        public:
+            FileDescriptor() noexcept {}
+            explicit FileDescriptor(int fd) noexcept : fd(fd) {}
+            FileDescriptor(const FileDescriptor&) = delete;
+            FileDescriptor(FileDescriptor&& other) noexcept : fd(other.release()) {}
+            FileDescriptor& operator=(const FileDescriptor&) = delete;
+            FileDescriptor& operator=(FileDescriptor&& other) noexcept {
+                if (this != &other) reset(other.release());
+                return *this;
+            }
+            ~FileDescriptor() { reset(); }
+
+            int get() const noexcept { return fd; }
+            operator int() const noexcept { return fd; }
+            explicit operator bool() const noexcept { return fd >= 0; }
+            int release() noexcept {
+                int tmp = fd;
+                fd = -1;
+                return tmp;
+            }
+            void reset(int newFd = -1) noexcept {
+                if (fd >= 0) ::close(fd);
+                fd = newFd;
+            }
+        };
+#endif
+
+        inline bool isDirectory(const Path& p);
+        inline Path followSoftLink(const Path& p);
+        inline bool isSoftLink(const Path& p);
+        inline bool isBlockFile(const Path& p);
+        inline bool isCharacterFile(const Path& p);
+        inline bool isEmptry(const Path& p);
+        inline bool isFIFO(const Path& p);
+        inline bool isOther(const Path& p);
+        inline bool isFile(const Path& p);
+
+        // Opt-in instrumentation, compiled in when ESTD_FILES_INSTRUMENTATION is defined before this header is
+        // included (the same way in every translation unit), otherwise the ESTD_FILES_COUNT and
+        // ESTD_FILES_OPERATION hooks expand to nothing and their arguments are not evaluated. Counters and latency
+        // histograms are kept per thread and summed on demand. The system call counters cover the calls this header
+        // makes itself, not the ones made inside std::filesystem.
+#ifdef ESTD_FILES_INSTRUMENTATION
+        namespace instrumentation {
+            enum class Counter : uint8_t {
+                open,
+                stat,
+                readDirectory, // getdents64
+                readLink,
+                softLink,
+                makeDirectory,
+                unlink,
+                clone,     // FICLONE
+                copyRange, // copy_file_range and sendfile
+                metadata,  // chmod and utimensat
+                bytesCopied,
+                entriesVisited,
+                errorsSwallowed, // collected by a multi entry operation to be rethrown at its end
+                count
+            };
+            enum class Operation : uint8_t {
+                copy,
+                copyFile,
+                copySoftLink,
+                copyDirectory,
+                createDirectories,
+                remove,
+                count
+            };
+
+            inline const char* name(Counter c) noexcept {
+                static const char* names[] = {
+                    "open",      "stat",     "readDirectory", "readLink",       "softLink",       "makeDirectory",
+                    "unlink",    "clone",    "copyRange",     "metadata",       "bytesCopied",    "entriesVisited",
+                    "errorsSwallowed"
+                };
+                return c < Counter::count ? names[size_t(c)] : "";
+            }
+            inline const char* name(Operation o) noexcept {
+                static const char* names[] = {
+                    "copy", "copyFile", "copySoftLink", "copyDirectory", "createDirectories", "remove"
+                };
+                return o < Operation::count ? names[size_t(o)] : "";
+            }
+
+            // latencies in power of two buckets, bucket i counts durations in [2^i, 2^(i+1)) nanoseconds
+            struct Histogram {
+                static constexpr size_t buckets = 40;
+                std::array<uint64_t, buckets> counts{};
+                uint64_t samples = 0;
+                uint64_t nanoseconds = 0; // sum of all samples
+
+                // upper bound of the bucket holding the q quantile (0 <= q <= 1), 0 without samples
+                uint64_t quantile(double q) const noexcept {
+                    uint64_t rank = uint64_t(q * double(samples)), seen = 0;
+                    for (size_t i = 0; i < buckets; i++) {
+                        seen += counts[i];
+                        if (seen > rank || (seen == samples && seen > 0)) return uint64_t(2) << i;
+                    }
+                    return 0;
+                }
+                Histogram& operator+=(const Histogram& other) noexcept {
+                    for (size_t i = 0; i < buckets; i++) counts[i] += other.counts[i];
+                    samples += other.samples;
+                    nanoseconds += other.nanoseconds;
+                    return *this;
+                }
+            };
+
+            struct Snapshot {
+                std::array<uint64_t, size_t(Counter::count)> counters{};
+                std::array<Histogram, size_t(Operation::count)> latencies{};
+
+                uint64_t operator[](Counter c) const noexcept { return counters[size_t(c)]; }
+                const Histogram& operator[](Operation o) const noexcept { return latencies[size_t(o)]; }
+            };
+
+            // installed with setHook(), called on the thread running the operation, must not throw
+            class Hook {
+            public:
+                virtual ~Hook() = default;
+                virtual void start(Operation, const Path&) {}
+                virtual void end(Operation, const Path&, std::chrono::nanoseconds, bool /* failed */) {}
+            };
+
+            namespace detail {
+                // written by its own thread only, relaxed atomics so other threads can read them
+                struct ThreadData {
+                    std::array<std::atomic<uint64_t>, size_t(Counter::count)> counters{};
+                    // per operation: the buckets, then samples and nanoseconds
+                    std::array<std::array<std::atomic<uint64_t>, Histogram::buckets + 2>, size_t(Operation::count)>
+                        latencies{};
+
+                    ThreadData();
+                    ~ThreadData();
+
+                    void read(Snapshot& s) const noexcept {
+                        for (size_t i = 0; i < counters.size(); i++) {
+                            s.counters[i] += counters[i].load(std::memory_order_relaxed);
+                        }
+                        for (size_t o = 0; o < latencies.size(); o++) {
+                            Histogram h;
+                            for (size_t i = 0; i < Histogram::buckets; i++) {
+                                h.counts[i] = latencies[o][i].load(std::memory_order_relaxed);
+                            }
+                            h.samples = latencies[o][Histogram::buckets].load(std::memory_order_relaxed);
+                            h.nanoseconds = latencies[o][Histogram::buckets + 1].load(std::memory_order_relaxed);
+                            s.latencies[o] += h;
+                        }
+                    }
+                    void reset() noexcept {
+                        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+                        for (auto& l : latencies) {
+                            for (auto& c : l) c.store(0, std::memory_order_relaxed);
+                        }
+                    }
+                };
+
+                struct Registry {
+                    std::mutex m;
+                    std::set<ThreadData*> threads;
+                    Snapshot retired; // of the threads that ended
+
+                    // leaked, threads can end after static destruction
+                    static Registry& get() {
+                        static Registry* registry = new Registry();
+                        return *registry;
+                    }
+                };
+
+                inline ThreadData::ThreadData() {
+                    Registry& r = Registry::get();
+                    std::lock_guard<std::mutex> lk(r.m);
+                    r.threads.insert(this);
+                }
+                inline ThreadData::~ThreadData() {
+                    Registry& r = Registry::get();
+                    std::lock_guard<std::mutex> lk(r.m);
+                    read(r.retired);
+                    r.threads.erase(this);
+                }
+
+                inline ThreadData& local() {
+                    thread_local ThreadData data;
+                    return data;
+                }
+                inline void add(std::atomic<uint64_t>& a, uint64_t n) noexcept { // no locked instruction needed
+                    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+                }
+                inline std::atomic<Hook*>& hook() noexcept {
+                    static std::atomic<Hook*> h{nullptr};
+                    return h;
+                }
+            } // namespace detail
+
+            inline void count(Counter c, uint64_t n = 1) { detail::add(detail::local().counters[size_t(c)], n); }
+
+            inline void record(Operation o, std::chrono::nanoseconds duration) {
+                auto& l = detail::local().latencies[size_t(o)];
+                const uint64_t ns = uint64_t(std::max<int64_t>(duration.count(), 1));
+                size_t bucket = 0;
+                while (bucket + 1 < Histogram::buckets && (ns >> (bucket + 1)) != 0) bucket++;
+                detail::add(l[bucket], 1);
+                detail::add(l[Histogram::buckets], 1);
+                detail::add(l[Histogram::buckets + 1], ns);
+            }
+
+            // the counters of the calling thread
+            inline Snapshot threadSnapshot() {
+                Snapshot s;
+                detail::local().read(s);
+                return s;
+            }
+            // the counters of all threads, including the ones that ended
+            inline Snapshot snapshot() {
+                detail::Registry& r = detail::Registry::get();
+                std::lock_guard<std::mutex> lk(r.m);
+                Snapshot s = r.retired;
+                for (const detail::ThreadData* t : r.threads) t->read(s);
+                return s;
+            }
+            // zeroes every counter, call it while no operation is running
+            inline void reset() {
+                detail::Registry& r = detail::Registry::get();
+                std::lock_guard<std::mutex> lk(r.m);
+                r.retired = Snapshot();
+                for (detail::ThreadData* t : r.threads) t->reset();
+            }
+
+            // installs the hook (nullptr removes it), returns the previous one, the caller keeps ownership
+            inline Hook* setHook(Hook* hook) noexcept { return detail::hook().exchange(hook); }
+
+            // times an operation and reports it to the hook, created by ESTD_FILES_OPERATION
+            class OperationScope {
+            private:
+                Operation op;
+                const Path& path;
+                Hook* hook;
+                int exceptions;
+                std::chrono::steady_clock::time_point start;
+
+            public:
+                OperationScope(Operation op, const Path& path)
+                    : op(op), path(path), hook(detail::hook().load(std::memory_order_acquire)),
+                      exceptions(std::uncaught_exceptions()) {
+                    if (hook) hook->start(op, path);
+                    start = std::chrono::steady_clock::now();
+                }
+                OperationScope(const OperationScope&) = delete;
+                OperationScope& operator=(const OperationScope&) = delete;
+                ~OperationScope() {
+                    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start
+                    );
+                    record(op, duration);
+                    if (hook) hook->end(op, path, duration, std::uncaught_exceptions() > exceptions);
+                }
+            };
+        } // namespace instrumentation
+
+    // the first count on a thread registers it (lock, allocation) and can change errno, count before the call
+    #define ESTD_FILES_COUNT(counter, n) \
+        ::estd::files::instrumentation::count(::estd::files::instrumentation::Counter::counter, n)
+    // path must outlive the scope, pass a named Path
+    #define ESTD_FILES_OPERATION(operation, path)                          \
+        ::estd::files::instrumentation::OperationScope estdFilesOperation( \
+            ::estd::files::instrumentation::Operation::operation, path     \
+        )
+#else
+    #define ESTD_FILES_COUNT(counter, n) ((void)0)
+    #define ESTD_FILES_OPERATION(operation, path) ((void)0)
+#endif
+
+        enum CopyOptions : uint64_t {
+            none = 0,
+
+            skipExisting = 1 << 0,
+            overwriteExisting = 1 << 1,
+            updateExisting = 1 << 2,
+
+            recursive = 1 << 3,
+
+            softLinksAsCopies = 1 << 4,
+            skipSoftLinks = 1 << 5,
+            directoriesOnly = 1 << 6,
+
+            copyAsSoftLinks = 1 << 7,
+            copyAsHardLinks = 1 << 8,
+            overwriteReadonly = 1 << 9,
+
+            parallel = 1 << 10, // expand directories and copy files on a thread pool (see copyParallel)
+
+            reflinkPreferred = 1 << 11, // try a copy on write clone (FICLONE) first, copy the data if unsupported
+            reflinkOnly = 1 << 12,      // fail instead of copying the data if a clone cannot be made
+
+            ioUring = 1 << 13, // submit file copies to io_uring in batches (see copyBatched)
+            dedupe = 1 << 14   // link files with identical content to one copy (see copyDeduplicated)
+        };
+
+        enum class FileType : uint8_t { none, regular, directory, softLink, block, character, fifo, socket, unknown };
+
+        namespace {
+#ifdef __linux__
+            inline FileType fileTypeFromMode(mode_t mode) noexcept {
+                switch (mode & S_IFMT) {
+                    case S_IFREG: return FileType::regular;
+                    case S_IFDIR: return FileType::directory;
+                    case S_IFLNK: return FileType::softLink;
+                    case S_IFBLK: return FileType::block;
+                    case S_IFCHR: return FileType::character;
+                    case S_IFIFO: return FileType::fifo;
+                    case S_IFSOCK: return FileType::socket;
+                    default: return FileType::unknown;
+                }
+            }
+
+            // record layout filled by getdents64
+            struct LinuxDirent64 {
+                uint64_t d_ino;
+                int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[1];
+            };
+
+            // calls f(name, d_type) for every entry of the open directory but . and .., the names are read in
+            // batches and only valid during the call, returns false with errno set if the listing failed
+            template <class F>
+            inline bool forEachDirent(int dir, const F& f, size_t bufferSize = 1 << 15) {
+                std::vector<char> buffer(bufferSize);
+                while (true) {
+                    ESTD_FILES_COUNT(readDirectory, 1);
+                    long n = ::syscall(SYS_getdents64, dir, buffer.data(), buffer.size());
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) return n == 0;
+                    for (long pos = 0; pos < n;) {
+                        auto* d = reinterpret_cast<LinuxDirent64*>(buffer.data() + pos);
+                        pos += d->d_reclen;
+                        const char* name = d->d_name;
+                        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+                        ESTD_FILES_COUNT(entriesVisited, 1);
+                        f(name, d->d_type);
+                    }
+                }
+            }
+
+            inline FileType fileTypeFromDirent(unsigned char type) noexcept {
+                switch (type) {
+                    case DT_REG: return FileType::regular;
+                    case DT_DIR: return FileType::directory;
+                    case DT_LNK: return FileType::softLink;
+                    case DT_BLK: return FileType::block;
+                    case DT_CHR: return FileType::character;
+                    case DT_FIFO: return FileType::fifo;
+                    case DT_SOCK: return FileType::socket;
+                    default: return FileType::unknown;
+                }
+            }
+#endif
+            inline FileType fileTypeFromStatus(const std::filesystem::file_status& st) noexcept {
+                using ft = std::filesystem::file_type;
+                switch (st.type()) {
+                    case ft::regular: return FileType::regular;
+                    case ft::directory: return FileType::directory;
+                    case ft::symlink: return FileType::softLink;
+                    case ft::block: return FileType::block;
+                    case ft::character: return FileType::character;
+                    case ft::fifo: return FileType::fifo;
+                    case ft::socket: return FileType::socket;
+                    case ft::not_found:
+                    case ft::none: return FileType::none;
+                    default: return FileType::unknown;
+                }
+            }
+        } // namespace
+
+        // Metadata of one entry taken with a single lstat (and a stat of the target for soft links). The copy
+        // overloads taking a FileStatus trust it instead of asking the kernel again, it is never refreshed.
+        class FileStatus {
+        private:
+            FileType iType = FileType::none;       // type of the entry itself
+            FileType iTargetType = FileType::none; // type after following a soft link, none if the link is broken
+            uint64_t iDevice = 0;
+            uint64_t iInode = 0;
+            uint64_t iSize = 0;
+            int64_t iModificationTime = 0; // nanoseconds, of the entry itself
+            std::filesystem::perms iPermissions = std::filesystem::perms::none;
+
+        public:
+            FileStatus() noexcept {}
+            // a trailing slash follows a soft link to a directory like lstat does, use removeEmptySuffix() to
+            // look at the link itself
+            explicit FileStatus(const Path& p) {
+#ifdef __linux__
+                const std::string path = p.string();
+                const char* s = path.empty() ? "." : path.c_str();
+                struct stat st;
+                ESTD_FILES_COUNT(stat, 1);
+                if (::lstat(s, &st) != 0) return;
+                iType = iTargetType = fileTypeFromMode(st.st_mode);
+                iDevice = st.st_dev;
+                iInode = st.st_ino;
+                iSize = uint64_t(st.st_size);
+                iModificationTime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+                iPermissions = std::filesystem::perms(st.st_mode & 07777);
+                if (iType == FileType::softLink) {
+                    ESTD_FILES_COUNT(stat, 1);
+                    iTargetType = ::stat(s, &st) == 0 ? fileTypeFromMode(st.st_mode) : FileType::none;
+                }
+#else
+                std::error_code ec;
+                auto st = std::filesystem::symlink_status(p, ec);
+                if (ec || !std::filesystem::exists(st)) return;
+                iType = iTargetType = fileTypeFromStatus(st);
+                iPermissions = st.permissions();
+                if (iType == FileType::softLink) iTargetType = fileTypeFromStatus(std::filesystem::status(p, ec));
+                if (iType == FileType::regular) iSize = std::filesystem::file_size(p, ec);
+                auto time = std::filesystem::last_write_time(p, ec);
+                if (!ec) {
+                    iModificationTime =
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+                }
+#endif
+            }
+
+            FileType type() const noexcept { return iType; }
+            FileType targetType() const noexcept { return iTargetType; }
+            uint64_t device() const noexcept { return iDevice; }
+            uint64_t inode() const noexcept { return iInode; }
+            uint64_t size() const noexcept { return iSize; }
+            int64_t modificationTime() const noexcept { return iModificationTime; }
+            std::filesystem::perms permissions() const noexcept { return iPermissions; }
+
+            // like exists(), a broken soft link exists
+            bool exists() const noexcept { return iType != FileType::none; }
+            bool isSoftLink() const noexcept { return iType == FileType::softLink; }
+            bool isDirectory() const noexcept { return iTargetType == FileType::directory; }
+            bool isFile() const noexcept { return iTargetType == FileType::regular; }
+        };
+
+        class DirectoryEntry : public std::filesystem::directory_entry {
+        public:
+            using std::filesystem::directory_entry::directory_entry;
+            Path path() const noexcept { return std::filesystem::directory_entry::path(); }
+            operator Path() const noexcept { return std::filesystem::directory_entry::path(); }
+            void assign(const Path& p) { std::filesystem::directory_entry::assign(p); }
+            // one lstat of the entry itself (soft links are not followed)
+            FileStatus fileStatus() const { return FileStatus(path().removeEmptySuffix()); }
+        };
+
+        class DirectoryIterator : public std::filesystem::directory_iterator {
+            mutable DirectoryEntry e;
+            mutable bool decorated = false; // e already holds the current entry
+
+        public:
+            using std::filesystem::directory_iterator::directory_iterator;
+            friend inline DirectoryIterator begin(DirectoryIterator iter) noexcept { return iter; }
+            friend inline DirectoryIterator end(DirectoryIterator) noexcept { return DirectoryIterator(); }
+            const DirectoryEntry& operator*() const noexcept {
+                if (decorated) return e;
+                decorated = true;
+                e = DirectoryEntry(std::filesystem::directory_iterator::operator*());
+
+                if (e.is_directory()) {
+                    e.assign(e.path().addEmptySuffix());
+                    return e;
+                } else if (e.is_symlink()) {
+                    if (isDirectory(e.path())) {
+                        e.assign(e.path().addEmptySuffix());
+                        return e;
+                    } else {
+                        e.assign(e.path().removeEmptySuffix());
+                        return e;
+                    }
+                }
+                e.assign(Path(e.path()).removeEmptySuffix());
+                return e;
+            }
+            const DirectoryEntry* operator->() const noexcept { return &*(*this); }
+            DirectoryIterator& operator++() {
+                std::filesystem::directory_iterator::operator++();
+                decorated = false;
+                return *this;
+            }
+            DirectoryIterator& increment(std::error_code& ec) {
+                std::filesystem::directory_iterator::increment(ec);
+                decorated = false;
+                return *this;
+            }
+
+            DirectoryIterator operator++(int) {
+                DirectoryIterator old{**this};
+                ++*this;
+                return old;
+            }
+        };
+        class RecursiveDirectoryIterator : public std::filesystem::recursive_directory_iterator {
+            mutable DirectoryEntry e;
+            mutable bool decorated = false; // e already holds the current entry
+
+        public:
+            using std::filesystem::recursive_directory_iterator::recursive_directory_iterator;
+            friend inline RecursiveDirectoryIterator begin(RecursiveDirectoryIterator iter) noexcept { return iter; }
+            friend inline RecursiveDirectoryIterator end(RecursiveDirectoryIterator) noexcept {
+                return RecursiveDirectoryIterator();
+            }
+            const DirectoryEntry& operator*() const noexcept {
+                if (decorated) return e;
+                decorated = true;
+                e = DirectoryEntry(std::filesystem::recursive_directory_iterator::operator*());
+                if (e.is_directory()) {
+                    e.assign(e.path().addEmptySuffix());
+                    return e;
+                } else if (e.is_symlink()) {
+                    if (isDirectory(e.path())) {
+                        e.assign(e.path().addEmptySuffix());
+                        return e;
+                    } else {
+                        e.assign(e.path().removeEmptySuffix());
+                        return e;
+                    }
+                }
+                e.assign(Path(e.path()).removeEmptySuffix());
+                return e;
+            }
+            const DirectoryEntry* operator->() const noexcept { return &*(*this); }
+            RecursiveDirectoryIterator& operator++() {
+                decorated = false;
+                return std::filesystem::recursive_directory_iterator::operator++(), *this;
+            }
+            RecursiveDirectoryIterator& increment(std::error_code& ec) {
+                decorated = false;
+                return std::filesystem::recursive_directory_iterator::increment(ec), *this;
+            }
+            void pop() {
+                decorated = false;
+                std::filesystem::recursive_directory_iterator::pop();
+            }
+            void pop(std::error_code& ec) {
+                decorated = false;
+                std::filesystem::recursive_directory_iterator::pop(ec);
+            }
+            RecursiveDirectoryIterator operator++(int) {
+                RecursiveDirectoryIterator old{**this};
+                ++*this;
+                return old;
+            }
+        };
+
+        // entry of FastDirectoryIterator, the path follows the DirectoryIterator convention (trailing slash for
+        // directories and soft links to directories) and is built once per entry
+        class FastDirectoryEntry {
+        private:
+            Path iPath;
+            FileType iType = FileType::none;       // type of the entry itself
+            FileType iTargetType = FileType::none; // type after following a soft link, none if the link is broken
+            uint64_t iInode = 0;
+            mutable FileStatus iStatus; // filled on the first fileStatus() call
+            mutable bool iHasStatus = false;
+
+            friend class FastDirectoryIterator;
+
+        public:
+            const Path& path() const noexcept { return iPath; }
+            operator const Path&() const noexcept { return iPath; }
+            FileType type() const noexcept { return iType; }
+            FileType targetType() const noexcept { return iTargetType; }
+            uint64_t inode() const noexcept { return iInode; }
+            // one lstat of the entry itself (soft links are not followed), cached
+            const FileStatus& fileStatus() const {
+                if (!iHasStatus) {
+                    iStatus = FileStatus(iPath.removeEmptySuffix());
+                    iHasStatus = true;
+                }
+                return iStatus;
+            }
+
+            bool isSoftLink() const noexcept { return iType == FileType::softLink; }
+            bool isDirectory() const noexcept { return iTargetType == FileType::directory; }
+            bool isFile() const noexcept { return iTargetType == FileType::regular; }
+        };
+
+        // Single pass directory listing. On linux the entries are read in large batches with getdents64 and
+        // classified from d_type, only soft links and DT_UNKNOWN entries cost an fstatat. Elsewhere it wraps
+        // std::filesystem::directory_iterator. Copies of the iterator share the same position.
+        class FastDirectoryIterator {
+        private:
+            struct State {
+                std::string root; // directory with a trailing slash
+                FastDirectoryEntry entry;
+#ifdef __linux__
+                FileDescriptor fd;
+                std::vector<char> buffer;
+                size_t pos = 0;
+                size_t len = 0;
+#else
+                std::filesystem::directory_iterator iter;
+                bool started = false;
+#endif
+            };
+            std::shared_ptr<State> state;
+
+#ifdef __linux__
+            void advance() {
+                State& st = *state;
+                while (true) {
+                    if (st.pos >= st.len) {
+                        ESTD_FILES_COUNT(readDirectory, 1);
+                        long n = ::syscall(SYS_getdents64, st.fd.get(), st.buffer.data(), st.buffer.size());
+                        if (n < 0) {
+                            if (errno == EINTR) continue;
+                            Path root = st.root;
+                            throwError(std::string("cannot read directory: ") + std::strerror(errno), &root);
+                        }
+                        if (n == 0) {
+                            state = nullptr;
+                            return;
+                        }
+                        st.pos = 0;
+                        st.len = size_t(n);
+                    }
+                    auto* d = reinterpret_cast<LinuxDirent64*>(st.buffer.data() + st.pos);
+                    st.pos += d->d_reclen;
+                    const char* name = d->d_name;
+                    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+                    ESTD_FILES_COUNT(entriesVisited, 1);
+                    FastDirectoryEntry& e = st.entry;
+                    e.iHasStatus = false;
+                    struct stat sb;
+                    e.iInode = d->d_ino;
+                    e.iType = fileTypeFromDirent(d->d_type);
+                    if (e.iType == FileType::unknown) {
+                        ESTD_FILES_COUNT(stat, 1);
+                        if (::fstatat(st.fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0) {
+                            e.iType = fileTypeFromMode(sb.st_mode);
+                        }
+                    }
+                    e.iTargetType = e.iType;
+                    if (e.iType == FileType::softLink) {
+                        ESTD_FILES_COUNT(stat, 1);
+                        e.iTargetType = ::fstatat(st.fd, name, &sb, 0) == 0 ? fileTypeFromMode(sb.st_mode)
+                                                                             : FileType::none;
+                    }
+                    std::string p = st.root;
+                    p += name;
+                    if (e.iTargetType == FileType::directory) p += '/';
+                    e.iPath = Path(std::move(p));
+                    return;
+                }
+            }
+#else
+            void advance() {
+                State& st = *state;
+                if (st.started) st.iter++;
+                st.started = true;
+                if (st.iter == std::filesystem::directory_iterator()) {
+                    state = nullptr;
+                    return;
+                }
+                FastDirectoryEntry& e = st.entry;
+                e.iHasStatus = false;
+                const auto& de = *st.iter;
+                e.iType = fileTypeFromStatus(de.symlink_status());
+                e.iTargetType = e.iType == FileType::softLink ? fileTypeFromStatus(de.status()) : e.iType;
+                e.iInode = 0;
+                std::string p = st.root + de.path().filename().string();
+                if (e.iTargetType == FileType::directory) p += '/';
+                e.iPath = Path(std::move(p));
+            }
+#endif
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = FastDirectoryEntry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const FastDirectoryEntry*;
+            using reference = const FastDirectoryEntry&;
+
+            FastDirectoryIterator() noexcept {}
+            explicit FastDirectoryIterator(const Path& p, size_t bufferSize = 1 << 16) : state(new State()) {
+                state->root = p.string();
+                if (!state->root.empty() && state->root.back() != '/') state->root += '/';
+#ifdef __linux__
+                ESTD_FILES_COUNT(open, 1);
+                state->fd.reset(::open(
+                    state->root.empty() ? "." : state->root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC
+                ));
+                if (!state->fd) throwError(std::string("cannot open directory: ") + std::strerror(errno), &p);
+                state->buffer.resize(std::max<size_t>(bufferSize, 4096));
+#else
+                state->iter = std::filesystem::directory_iterator(p);
+#endif
+                advance();
+            }
+
+            friend inline FastDirectoryIterator begin(FastDirectoryIterator iter) noexcept { return iter; }
+            friend inline FastDirectoryIterator end(FastDirectoryIterator) noexcept { return FastDirectoryIterator(); }
+
+            const FastDirectoryEntry& operator*() const noexcept { return state->entry; }
+            const FastDirectoryEntry* operator->() const noexcept { return &state->entry; }
+            FastDirectoryIterator& operator++() {
+                advance();
+                return *this;
+            }
+
+            friend bool operator==(const FastDirectoryIterator& lhs, const FastDirectoryIterator& rhs) noexcept {
+                return lhs.state == rhs.state;
+            }
+            friend bool operator!=(const FastDirectoryIterator& lhs, const FastDirectoryIterator& rhs) noexcept {
+                return lhs.state != rhs.state;
+            }
+        };
+
+        enum class WalkAction { proceed, skipSubtree };
+
+        struct WalkOptions {
+            size_t threads = 0;                                   // 0 = hardware concurrency
+            size_t maxDepth = std::numeric_limits<size_t>::max(); // 1 = only the entries of the root
+            bool deterministic = false; // visit from the calling thread in sorted depth first order
+        };
+
+        // called for every entry below the root (not the root itself), from any worker thread unless
+        // WalkOptions::deterministic is set, the returned action decides if a directory is entered
+        using WalkVisitor = std::function<WalkAction(const FastDirectoryEntry&)>;
+
+        // Walks the tree under root listing subdirectories concurrently on a work stealing pool. Soft links are
+        // reported but never entered. Errors do not stop the walk, the last one is rethrown at the end.
+        inline void walkParallel(const Path& root, const WalkVisitor& visitor, const WalkOptions& options = {}) {
+            if (options.maxDepth == 0) return;
+
+            std::mutex errMutex;
+            estd::stack_ptr<std::runtime_error> err;
+            auto setError = [&](const std::exception& e) {
+                std::lock_guard<std::mutex> lk(errMutex);
+                err = std::runtime_error(e.what());
+            };
+            auto enters = [&](const FastDirectoryEntry& e, size_t depth) {
+                return e.isDirectory() && !e.isSoftLink() && depth < options.maxDepth;
+            };
+
+            if (!options.deterministic) {
+                WorkStealingPool pool(options.threads);
+                std::function<void(Path, size_t)> expand;
+                expand = [&](Path dir, size_t depth) {
+                    try {
+                        for (const auto& e : FastDirectoryIterator(dir)) {
+                            try {
+                                if (visitor(e) == WalkAction::proceed && enters(e, depth)) {
+                                    pool.submit([&, sub = e.path(), depth] { expand(sub, depth + 1); });
+                                }
+                            } catch (std::exception& tmp) { setError(tmp); }
+                        }
+                    } catch (std::exception& tmp) { setError(tmp); }
+                };
+                pool.submit([&] { expand(root, 1); });
+                pool.wait();
+                if (err) throw err.value();
+                return;
+            }
+
+            // deterministic: workers list directories ahead of the caller, which visits them in order
+            struct Node {
+                Path dir;
+                size_t depth = 1;
+                const Node* parent = nullptr;
+                std::atomic<bool> skipped{false};
+                std::vector<FastDirectoryEntry> entries;
+                std::vector<std::unique_ptr<Node>> children; // aligned with entries, null if not entered
+                estd::stack_ptr<std::runtime_error> error;
+                bool listed = false;
+                std::mutex m;
+                std::condition_variable cv;
+
+                bool cancelled() const {
+                    for (const Node* n = this; n != nullptr; n = n->parent) {
+                        if (n->skipped) return true;
+                    }
+                    return false;
+                }
+            };
+
+            WorkStealingPool pool(options.threads);
+            std::function<void(Node*)> list;
+            list = [&](Node* node) {
+                std::vector<FastDirectoryEntry> entries;
+                std::vector<std::unique_ptr<Node>> children;
+                estd::stack_ptr<std::runtime_error> error;
+                try {
+                    if (!node->cancelled()) {
+                        for (const auto& e : FastDirectoryIterator(node->dir)) entries.push_back(e);
+                    }
+                } catch (std::exception& tmp) { error = std::runtime_error(tmp.what()); }
+                std::sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) {
+                    return lhs.path() < rhs.path();
+                });
+                for (const auto& e : entries) {
+                    children.emplace_back();
+                    if (!enters(e, node->depth)) continue;
+                    children.back().reset(new Node());
+                    children.back()->dir = e.path();
+                    children.back()->depth = node->depth + 1;
+                    children.back()->parent = node;
+                }
+                {
+                    std::lock_guard<std::mutex> lk(node->m);
+                    node->entries = std::move(entries);
+                    node->children = std::move(children);
+                    node->error = std::move(error);
+                    node->listed = true;
+                }
+                node->cv.notify_all();
+                for (auto& child : node->children) {
+                    if (child) pool.submit([&, c = child.get()] { list(c); });
+                }
+            };
+
+            std::function<void(Node*)> visit;
+            visit = [&](Node* node) {
+                {
+                    std::unique_lock<std::mutex> lk(node->m);
+                    node->cv.wait(lk, [&] { return node->listed; });
+                }
+                if (node->error) setError(node->error.value());
+                for (size_t i = 0; i < node->entries.size(); i++) {
+                    WalkAction action = WalkAction::skipSubtree;
+                    try {
+                        action = visitor(node->entries[i]);
+                    } catch (std::exception& tmp) { setError(tmp); }
+                    Node* child = node->children[i].get();
+                    if (child == nullptr) continue;
+                    if (action == WalkAction::proceed) {
+                        visit(child);
+                    } else {
+                        child->skipped = true; // pending listings under it become no-ops
+                    }
+                }
+                node->entries = {}; // visited, keep only the skeleton alive for the workers
+            };
+
+            Node rootNode;
+            rootNode.dir = root;
+            pool.submit([&] { list(&rootNode); });
+            visit(&rootNode);
+            pool.wait();
+            if (err) throw err.value();
+        }
+
+        // Glob patterns compiled once and matched one path component at a time, relative to the root of a walk.
+        //   *  ?  [abc]  [a-z]  [!x]   within one component, \ escapes the next character
+        //   **                         any number of components
+        //   {cpp,hpp}                  alternatives, expanded when compiling
+        //   trailing /                 directories only
+        //   leading !                  exclude, a directory that is excluded is not entered
+        // An entry matches if any positive pattern (everything, if there are none) matches it and no exclude
+        // pattern matches it or one of its parents. Walks carry a State per directory so no path is matched twice
+        // and directories under which no positive pattern can match are never opened.
+        class Glob {
+        private:
+            struct Segment {
+                enum Kind : uint8_t { literal, suffix, any, wildcard, globstar } kind;
+                std::string text; // the literal, the suffix after "*", or the whole wildcard
+            };
+            struct Pattern {
+                std::vector<Segment> segments;
+                bool directoryOnly = false;
+                bool negative = false;
+            };
+            std::vector<Pattern> iPatterns;
+            bool iHasPositive = false;
+
+            static void expandBraces(const std::string& p, std::vector<std::string>& out) {
+                size_t open = std::string::npos;
+                for (size_t i = 0; i < p.size(); i++) {
+                    if (p[i] == '\\') {
+                        i++;
+                    } else if (p[i] == '{') {
+                        open = i;
+                        break;
+                    }
+                }
+                if (open == std::string::npos) {
+                    out.push_back(p);
+                    return;
+                }
+                std::vector<size_t> commas;
+                size_t depth = 0, close = std::string::npos;
+                for (size_t i = open + 1; i < p.size() && close == std::string::npos; i++) {
+                    if (p[i] == '\\') {
+                        i++;
+                    } else if (p[i] == '{') {
+                        depth++;
+                    } else if (p[i] == '}') {
+                        if (depth == 0) close = i;
+                        else depth--;
+                    } else if (p[i] == ',' && depth == 0) {
+                        commas.push_back(i);
+                    }
+                }
+                if (close == std::string::npos) throw std::invalid_argument("Glob: unbalanced '{' in " + p);
+                commas.push_back(close);
+                size_t start = open + 1;
+                for (size_t c : commas) {
+                    expandBraces(p.substr(0, open) + p.substr(start, c - start) + p.substr(close + 1), out);
+                    start = c + 1;
+                }
+            }
+
+            static bool matchClass(std::string_view pattern, size_t& i, char c) noexcept {
+                // pattern[i] is '[', leaves i on the closing ']'
+                size_t j = i + 1;
+                bool negate = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+                if (negate) j++;
+                bool found = false;
+                for (bool first = true; j < pattern.size() && (first || pattern[j] != ']'); first = false) {
+                    char lo = pattern[j];
+                    if (lo == '\\' && j + 1 < pattern.size()) lo = pattern[++j];
+                    char hi = lo;
+                    if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                        hi = pattern[j + 2];
+                        j += 2;
+                    }
+                    found = found || (lo <= c && c <= hi);
+                    j++;
+                }
+                i = j;
+                return found != negate;
+            }
+
+            // one component against one wildcard, '*' backtracks to its last position only
+            static bool matchWildcard(std::string_view pattern, std::string_view name) noexcept {
+                size_t p = 0, n = 0, starP = std::string_view::npos, starN = 0;
+                while (n < name.size()) {
+                    if (p < pattern.size() && pattern[p] == '*') {
+                        starP = ++p;
+                        starN = n;
+                        continue;
+                    }
+                    if (p < pattern.size()) {
+                        size_t q = p;
+                        bool ok;
+                        if (pattern[q] == '?') {
+                            ok = true;
+                        } else if (pattern[q] == '[') {
+                            ok = matchClass(pattern, q, name[n]);
+                        } else {
+                            if (pattern[q] == '\\' && q + 1 < pattern.size()) q++;
+                            ok = pattern[q] == name[n];
+                        }
+                        if (ok) {
+                            p = q + 1;
+                            n++;
+                            continue;
+                        }
+                    }
+                    if (starP == std::string_view::npos) return false;
+                    p = starP;
+                    n = ++starN;
+                }
+                while (p < pattern.size() && pattern[p] == '*') p++;
+                return p == pattern.size();
+            }
+
+            static bool matchSegment(const Segment& s, std::string_view name) noexcept {
+                switch (s.kind) {
+                    case Segment::literal: return name == s.text;
+                    case Segment::suffix: { // memcmp is the vectorized compare of the C library
+                        const size_t n = s.text.size();
+                        return name.size() >= n && std::memcmp(name.data() + name.size() - n, s.text.data(), n) == 0;
+                    }
+                    case Segment::any: return true;
+                    case Segment::wildcard: return matchWildcard(s.text, name);
+                    case Segment::globstar: return true;
+                }
+                return false;
+            }
+
+            static uint64_t closure(const Pattern& p, uint64_t set) noexcept {
+                for (size_t i = 0; i < p.segments.size(); i++) { // ** can also match no component
+                    if ((set >> i & 1) && p.segments[i].kind == Segment::globstar) set |= uint64_t(1) << (i + 1);
+                }
+                return set;
+            }
+
+            void add(std::string_view text) {
+                Pattern pattern;
+                if (!text.empty() && text[0] == '!') {
+                    pattern.negative = true;
+                    text.remove_prefix(1);
+                }
+                while (text.substr(0, 2) == "./") text.remove_prefix(2);
+                if (!text.empty() && text.back() == '/') {
+                    pattern.directoryOnly = true;
+                    text.remove_suffix(1);
+                }
+                std::vector<std::string> expanded;
+                expandBraces(std::string(text), expanded);
+                for (const auto& e : expanded) {
+                    Pattern p = pattern;
+                    for (PathView component : PathView(e).components()) {
+                        std::string_view c = component.view();
+                        if (c.empty()) continue; // duplicate separators
+                        Segment s{Segment::literal, std::string(c)};
+                        bool meta = c.find_first_of("*?[\\") != std::string_view::npos;
+                        if (c == "**") {
+                            s.kind = Segment::globstar;
+                        } else if (c == "*") {
+                            s.kind = Segment::any;
+                        } else if (meta && c[0] == '*' && c.find_first_of("*?[\\", 1) == std::string_view::npos) {
+                            s.kind = Segment::suffix;
+                            s.text = std::string(c.substr(1));
+                        } else if (meta) {
+                            s.kind = Segment::wildcard;
+                        }
+                        if (s.kind == Segment::globstar && !p.segments.empty() &&
+                            p.segments.back().kind == Segment::globstar) {
+                            continue; // **/** is **
+                        }
+                        p.segments.push_back(std::move(s));
+                    }
+                    if (p.segments.size() > 63) throw std::invalid_argument("Glob: pattern too deep " + e);
+                    iHasPositive = iHasPositive || !p.negative;
+                    iPatterns.push_back(std::move(p));
+                }
+            }
+
+            bool accepted(const Pattern& p, uint64_t set, bool directory) const noexcept {
+                return (set >> p.segments.size() & 1) && (directory || !p.directoryOnly);
+            }
+
+        public:
+            using State = std::vector<uint64_t>; // live segment positions, one mask per compiled pattern
+
+            explicit Glob(std::string_view pattern) { add(pattern); }
+            Glob(std::initializer_list<std::string_view> patterns) {
+                for (auto p : patterns) add(p);
+            }
+            explicit Glob(const std::vector<std::string>& patterns) {
+                for (const auto& p : patterns) add(p);
+            }
+
+            // state of the walk root
+            State start() const {
+                State s(iPatterns.size());
+                for (size_t i = 0; i < iPatterns.size(); i++) s[i] = closure(iPatterns[i], 1);
+                return s;
+            }
+            // state of the entry `component` in the directory with state s
+            State step(const State& s, std::string_view component) const {
+                State next(iPatterns.size());
+                for (size_t i = 0; i < iPatterns.size(); i++) {
+                    const Pattern& p = iPatterns[i];
+                    uint64_t set = 0;
+                    for (size_t j = 0; j < p.segments.size(); j++) {
+                        if (!(s[i] >> j & 1)) continue;
+                        if (p.segments[j].kind == Segment::globstar) set |= uint64_t(1) << j;
+                        if (matchSegment(p.segments[j], component)) set |= uint64_t(1) << (j + 1);
+                    }
+                    next[i] = closure(p, set);
+                }
+                return next;
+            }
+            // a positive pattern matches the entry (exclusions are checked with excludes())
+            bool accepts(const State& s, bool directory) const noexcept {
+                if (!iHasPositive) return true;
+                for (size_t i = 0; i < iPatterns.size(); i++) {
+                    if (!iPatterns[i].negative && accepted(iPatterns[i], s[i], directory)) return true;
+                }
+                return false;
+            }
+            bool excludes(const State& s, bool directory) const noexcept {
+                for (size_t i = 0; i < iPatterns.size(); i++) {
+                    if (iPatterns[i].negative && accepted(iPatterns[i], s[i], directory)) return true;
+                }
+                return false;
+            }
+            // a positive pattern could still match something below the directory with state s
+            bool alive(const State& s) const noexcept {
+                if (!iHasPositive) return true;
+                for (size_t i = 0; i < iPatterns.size(); i++) {
+                    const Pattern& p = iPatterns[i];
+                    uint64_t below = (uint64_t(1) << p.segments.size()) - 1; // positions before the end
+                    if (!p.negative && (s[i] & below)) return true;
+                }
+                return false;
+            }
+
+            // path relative to the walk root, directories with a trailing slash
+            bool matches(PathView relative) const {
+                const bool directory = relative.isDirectory();
+                PathView p = directory ? relative.removeEmptySuffix() : relative;
+                State s = start();
+                bool any = false;
+                for (PathView component : p.components()) {
+                    std::string_view c = component.view();
+                    if (c.empty() || c == ".") continue;
+                    if (any && excludes(s, true)) return false; // a parent is excluded
+                    s = step(s, c);
+                    any = true;
+                }
+                return any && !excludes(s, directory) && accepts(s, directory);
+            }
+            // false if nothing below the directory (relative to the walk root) can match
+            bool mayMatchBelow(PathView directory) const {
+                State s = start();
+                for (PathView component : directory.components()) {
+                    std::string_view c = component.view();
+                    if (c.empty() || c == ".") continue;
+                    s = step(s, c);
+                    if (excludes(s, true)) return false;
+                }
+                return alive(s);
+            }
+        };
+
+        // Walks the tree under root calling the visitor for every matching entry, subtrees that cannot match are
+        // not opened. Soft links are matched but never entered. Errors do not stop the walk, the last one is
+        // rethrown at the end.
+        inline void globWalk(
+            const Path& root, const Glob& glob, const std::function<void(const FastDirectoryEntry&)>& visitor
+        ) {
+            estd::stack_ptr<std::runtime_error> err;
+            std::function<void(const Path&, const Glob::State&)> walk;
+            walk = [&](const Path& dir, const Glob::State& state) {
+                try {
+                    const size_t prefix = dir.view().size() + (dir.view().empty() || dir.view().back() == '/' ? 0 : 1);
+                    for (const auto& e : FastDirectoryIterator(dir)) {
+                        try {
+                            std::string_view name = e.path().view().substr(prefix);
+                            const bool directory = e.isDirectory();
+                            if (directory) name.remove_suffix(1);
+                            Glob::State s = glob.step(state, name);
+                            if (glob.excludes(s, directory)) continue;
+                            if (glob.accepts(s, directory)) visitor(e);
+                            if (directory && !e.isSoftLink() && glob.alive(s)) walk(e.path(), s);
+                        } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
+                    }
+                } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
+            };
+            walk(root, glob.start());
+            if (err) throw err.value();
+        }
+
+        // the matching paths under root, sorted
+        inline std::vector<Path> glob(const Path& root, const Glob& pattern) {
+            std::vector<Path> result;
+            globWalk(root, pattern, [&](const FastDirectoryEntry& e) { result.push_back(e.path()); });
+            std::sort(result.begin(), result.end());
+            return result;
+        }
+
+        // RecursiveDirectoryIterator that only stops at matching entries and does not recurse into directories
+        // under which nothing can match
+        class GlobIterator {
+        private:
+            struct State {
+                RecursiveDirectoryIterator iter;
+                Glob glob;
+                size_t prefix; // length of the root in the iterated paths
+            };
+            std::shared_ptr<State> state;
+
+            void advance(bool first) {
+                State& st = *state;
+                if (!first) ++st.iter;
+                for (; st.iter != RecursiveDirectoryIterator(); ++st.iter) {
+                    const Path path = st.iter->path();
+                    PathView relative = path.view().substr(std::min(st.prefix, path.view().size()));
+                    if (relative.isDirectory() && !st.glob.mayMatchBelow(relative)) st.iter.disable_recursion_pending();
+                    if (st.glob.matches(relative)) return;
+                }
+                state = nullptr;
+            }
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = DirectoryEntry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const DirectoryEntry*;
+            using reference = const DirectoryEntry&;
+
+            GlobIterator() noexcept {}
+            GlobIterator(const Path& root, Glob glob) {
+                Path r = root.addEmptySuffix();
+                state.reset(new State{RecursiveDirectoryIterator(r), std::move(glob), r.view().size()});
+                advance(true);
+            }
+
+            friend inline GlobIterator begin(GlobIterator iter) noexcept { return iter; }
+            friend inline GlobIterator end(GlobIterator) noexcept { return GlobIterator(); }
+
+            const DirectoryEntry& operator*() const noexcept { return *state->iter; }
+            const DirectoryEntry* operator->() const noexcept { return &*state->iter; }
+            GlobIterator& operator++() {
+                advance(false);
+                return *this;
+            }
+            friend bool operator==(const GlobIterator& lhs, const GlobIterator& rhs) noexcept {
+                return lhs.state == rhs.state;
+            }
+            friend bool operator!=(const GlobIterator& lhs, const GlobIterator& rhs) noexcept {
+                return lhs.state != rhs.state;
+            }
+        };
+
+#ifdef __linux__
+        // totals of a directory tree, see diskUsage()
+        struct DiskUsage {
+            uint64_t apparentSize = 0;  // st_size of everything but directories
+            uint64_t allocatedSize = 0; // allocated blocks of everything including the directories, in bytes
+            uint64_t files = 0;         // entries that are no directories, soft links included
+            uint64_t directories = 0;   // subdirectories, not counting the directory itself
+
+            DiskUsage& operator+=(const DiskUsage& other) noexcept {
+                apparentSize += other.apparentSize;
+                allocatedSize += other.allocatedSize;
+                files += other.files;
+                directories += other.directories;
+                return *this;
+            }
+        };
+
+        // What diskUsage() learned about each directory, keyed by device and inode. A directory whose modification
+        // time did not change is not listed again: its files and the names of its subdirectories are reused, the
+        // subdirectories are still checked. A file that changes size in place does not touch its directory, that
+        // is only seen once the directory changes or after clear(). Entries of removed directories stay until
+        // clear(). Thread safe, one cache can serve several roots.
+        class DiskUsageCache {
+        public:
+            struct LinkedFile {
+                uint64_t device, inode, size, allocated;
+            };
+            struct Entry {
+                int64_t modificationTime = 0;
+                DiskUsage own;                           // the files of the directory with a single link
+                std::vector<std::string> subdirectories; // names
+                std::vector<LinkedFile> linked;          // files with more links, counted once per walk
+            };
+
+        private:
+            mutable std::mutex m;
+            std::map<std::pair<uint64_t, uint64_t>, std::shared_ptr<const Entry>> entries;
+            std::atomic<size_t> iHits{0}, iMisses{0};
+
+        public:
+            std::shared_ptr<const Entry> find(uint64_t device, uint64_t inode, int64_t modificationTime) {
+                std::lock_guard<std::mutex> lk(m);
+                auto it = entries.find({device, inode});
+                if (it == entries.end() || it->second->modificationTime != modificationTime) {
+                    iMisses++;
+                    return nullptr;
+                }
+                iHits++;
+                return it->second;
+            }
+            void store(uint64_t device, uint64_t inode, std::shared_ptr<const Entry> entry) {
+                std::lock_guard<std::mutex> lk(m);
+                entries[{device, inode}] = std::move(entry);
+            }
+
+            size_t size() const {
+                std::lock_guard<std::mutex> lk(m);
+                return entries.size();
+            }
+            size_t hits() const noexcept { return iHits; }
+            size_t misses() const noexcept { return iMisses; }
+            void clear() {
+                std::lock_guard<std::mutex> lk(m);
+                entries.clear();
+            }
+        };
+
+        struct DiskUsageOptions {
+            size_t threads = 0;               // 0 = hardware concurrency
+            bool hardLinksOnce = true;        // a file with several links counts at the first one found
+            DiskUsageCache* cache = nullptr;  // reused between calls to skip unchanged directories
+        };
+
+        // The totals of every directory in the tree under root, keyed with a trailing slash, root included.
+        // Directories are listed concurrently on a work stealing pool with one fstatat per entry, a directory adds
+        // its total to its parent when its last subdirectory is done. Soft links are counted, never followed.
+        // Errors do not stop the walk, the last one is rethrown at the end.
+        inline std::map<Path, DiskUsage> diskUsage(const Path& root, const DiskUsageOptions& options = {}) {
+            struct Directory {
+                std::shared_ptr<Directory> parent;
+                std::string path; // with a trailing slash
+                std::mutex m;
+                DiskUsage total;
+                std::atomic<size_t> pending{1}; // its own listing plus one per subdirectory not done yet
+            };
+
+            std::mutex errMutex;
+            estd::stack_ptr<std::runtime_error> err;
+            auto fail = [&](const char* what, const std::string& path, int error) {
+                std::lock_guard<std::mutex> lk(errMutex);
+                err = std::runtime_error(
+                    std::string("filesystem error: ") + what + std::strerror(error) + " [" + path + "]"
+                );
+            };
+            std::mutex resultMutex;
+            std::map<Path, DiskUsage> result;
+            std::mutex linkMutex;
+            std::set<std::pair<uint64_t, uint64_t>> seen;
+            WorkStealingPool pool(options.threads);
+
+            auto release = [&](std::shared_ptr<Directory> d) {
+                for (; d && --d->pending == 0; d = d->parent) {
+                    DiskUsage total;
+                    {
+                        std::lock_guard<std::mutex> lk(d->m);
+                        total = d->total;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lk(resultMutex);
+                        result[Path(d->path)] = total;
+                    }
+                    if (!d->parent) continue;
+                    std::lock_guard<std::mutex> lk(d->parent->m);
+                    d->parent->total += total;
+                }
+            };
+            auto addLinked = [&](DiskUsage& usage, const DiskUsageCache::LinkedFile& f) {
+                if (options.hardLinksOnce) {
+                    std::lock_guard<std::mutex> lk(linkMutex);
+                    if (!seen.insert({f.device, f.inode}).second) return;
+                }
+                usage.files++;
+                usage.apparentSize += f.size;
+                usage.allocatedSize += f.allocated;
+            };
+
+            std::function<void(std::shared_ptr<Directory>)> scan;
+            scan = [&](std::shared_ptr<Directory> d) {
+                DiskUsage own;
+                FileDescriptor fd(::open(d->path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+                struct stat st;
+                if (!fd || ::fstat(fd, &st) != 0) {
+                    if (errno != ENOENT || !d->parent) fail("cannot open directory: ", d->path, errno);
+                    release(d);
+                    return;
+                }
+                own.allocatedSize += uint64_t(st.st_blocks) * 512;
+                const int64_t modificationTime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+                auto subdirectory = [&](const std::string& name) {
+                    auto child = std::make_shared<Directory>();
+                    child->parent = d;
+                    child->path = d->path + name + "/";
+                    own.directories++;
+                    d->pending++;
+                    pool.submit([&scan, child] { scan(child); });
+                };
+
+                auto cached = options.cache ? options.cache->find(st.st_dev, st.st_ino, modificationTime) : nullptr;
+                if (cached) {
+                    own += cached->own;
+                    for (const auto& f : cached->linked) addLinked(own, f);
+                    for (const auto& name : cached->subdirectories) subdirectory(name);
+                } else {
+                    auto entry = std::make_shared<DiskUsageCache::Entry>();
+                    entry->modificationTime = modificationTime;
+                    bool listed = forEachDirent(fd, [&](const char* name, unsigned char type) {
+                        struct stat es;
+                        if (type != DT_DIR && ::fstatat(fd, name, &es, AT_SYMLINK_NOFOLLOW) != 0) {
+                            if (errno != ENOENT) fail("cannot stat: ", d->path + name, errno);
+                            return;
+                        }
+                        if (type == DT_DIR || S_ISDIR(es.st_mode)) {
+                            entry->subdirectories.emplace_back(name);
+                            subdirectory(entry->subdirectories.back());
+                        } else if (es.st_nlink > 1) {
+                            entry->linked.push_back(
+                                {uint64_t(es.st_dev), uint64_t(es.st_ino), uint64_t(es.st_size),
+                                 uint64_t(es.st_blocks) * 512}
+                            );
+                            addLinked(own, entry->linked.back());
+                        } else {
+                            entry->own.files++;
+                            entry->own.apparentSize += uint64_t(es.st_size);
+                            entry->own.allocatedSize += uint64_t(es.st_blocks) * 512;
+                        }
+                    });
+                    if (listed) {
+                        own += entry->own;
+                        if (options.cache) options.cache->store(st.st_dev, st.st_ino, std::move(entry));
+                    } else {
+                        fail("cannot read directory: ", d->path, errno);
+                    }
+                }
+                {
+                    std::lock_guard<std::mutex> lk(d->m);
+                    d->total += own;
+                }
+                release(d);
+            };
+
+            auto rootDirectory = std::make_shared<Directory>();
+            rootDirectory->path = root.addEmptySuffix().string();
+            if (rootDirectory->path.empty()) rootDirectory->path = "./";
+            pool.submit([&scan, rootDirectory] { scan(rootDirectory); });
+            rootDirectory = nullptr;
+            pool.wait();
+            if (err) throw err.value();
+            return result;
+        }
+#endif
+
+        typedef std::filesystem::perms Permissions;
+
+        using FileTime = std::filesystem::file_time_type;
+        inline Permissions getPermissions(const Path& p) { return std::filesystem::status(p).permissions(); }
+        template <class T>
+        inline void setPermissions(const Path& path, T perm) {
+            std::filesystem::permissions(path, Permissions(perm));
+        }
+        inline Path currentPath() { return std::filesystem::current_path(); }
+        inline void copy(const Path& from, const Path& to, const uint64_t opt = CopyOptions::recursive);
+        inline void copy(
+            const Path& from, const FileStatus& fromStatus, const Path& to, const uint64_t opt = CopyOptions::recursive
+        );
+
+        inline bool exists(const Path& p) {
+            return std::filesystem::exists(p) || std::filesystem::is_symlink(p);
+        } // standards version returns false on broken symlink if symlink exists (strange)
+        namespace {
+#ifdef __linux__
+            // name of an entry relative to its parent, the full path is only put together to report an error
+            struct RelativeName {
+                const RelativeName* parent;
+                const char* name;
+
+                Path path(bool directory = false) const {
+                    std::vector<const char*> names;
+                    for (const RelativeName* n = this; n != nullptr; n = n->parent) names.push_back(n->name);
+                    std::string p = names.back();
+                    for (size_t i = names.size() - 1; i-- > 0;) {
+                        if (!p.empty() && p.back() != '/') p += '/';
+                        p += names[i];
+                    }
+                    if (directory) p += '/';
+                    return p;
+                }
+                // throws `what` followed by the description of errno
+                void fail(const char* what, bool directory = false) const {
+                    std::string description = std::string(what) + std::strerror(errno);
+                    Path p = path(directory);
+                    throwError(description, &p);
+                }
+            };
+
+            // removes the entry `name.name` of the open directory `dir`, directories with everything below them,
+            // soft links are never followed, returns the number of removed entries like remove_all
+            inline uintmax_t removeAt(int dir, const RelativeName& name, unsigned char type = DT_UNKNOWN) {
+                if (type != DT_DIR) {
+                    ESTD_FILES_COUNT(unlink, 1);
+                    if (::unlinkat(dir, name.name, 0) == 0) return 1;
+                    if (errno == ENOENT) return 0;
+                    if (errno != EISDIR) name.fail("cannot remove: ");
+                }
+                ESTD_FILES_COUNT(open, 1);
+                FileDescriptor fd(::openat(dir, name.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+                if (!fd) {
+                    if (errno == ENOENT) return 0;
+                    if (type == DT_DIR && (errno == ENOTDIR || errno == ELOOP)) return removeAt(dir, name); // raced
+                    name.fail("cannot open directory: ", true);
+                }
+                uintmax_t count = 0;
+                bool listed = forEachDirent(fd, [&](const char* child, unsigned char childType) {
+                    count += removeAt(fd, RelativeName{&name, child}, childType);
+                });
+                if (!listed) name.fail("cannot read directory: ", true);
+                ESTD_FILES_COUNT(unlink, 1);
+                if (::unlinkat(dir, name.name, AT_REMOVEDIR) != 0 && errno != ENOENT) {
+                    name.fail("cannot remove: ", true);
+                }
+                return count + 1;
+            }
+#endif
+        } // namespace
+
+        // removes the entry and everything below it, soft links (also to directories, with or without the trailing
+        // slash) are removed themselves and never followed, returns the number of removed entries
+        inline uintmax_t remove(const Path& p) {
+            ESTD_FILES_OPERATION(remove, p);
+#ifdef __linux__
+            const std::string root = p.removeEmptySuffix().string();
+            if (!root.empty()) return removeAt(AT_FDCWD, RelativeName{nullptr, root.c_str()});
+#endif
+            return std::filesystem::remove_all(p);
+        }
+        inline bool isDirectory(const Path& p) { return std::filesystem::is_directory(p); }
+        inline Path followSoftLink(const Path& p) { return std::filesystem::read_symlink(p); }
+        inline bool isSoftLink(const Path& p) { return std::filesystem::is_symlink(p); }
+        inline bool isBlockFile(const Path& p) { return std::filesystem::is_block_file(p); }
+        inline bool isCharacterFile(const Path& p) { return std::filesystem::is_character_file(p); }
+        inline bool isEmptry(const Path& p) { return std::filesystem::is_empty(p); }
+        inline bool isFIFO(const Path& p) { return std::filesystem::is_fifo(p); }
+        inline bool isOther(const Path& p) { return std::filesystem::is_other(p); }
+        inline bool isFile(const Path& p) { return std::filesystem::is_regular_file(p); }
+
+        // Follows soft link chains and remembers the results, for scans that meet the same links over and over.
+        // Results are keyed by the path as passed and kept in two generations: once the current one holds half the
+        // capacity it replaces the previous one, so at most `capacity` results are cached and recently used ones
+        // survive. Loops are found by counting hops like the kernel does, nothing is allocated to detect them.
+        // The cache is a snapshot, clear() it after changing links. Not thread safe.
+        class LinkResolver {
+        public:
+            struct Resolution {
+                Path target;                    // the links followed lexically, the path itself if it is no link
+                FileType type = FileType::none; // of the final target, none for broken links and loops
+                uint8_t hops = 0;               // soft links followed
+                bool loop = false;              // too many links to follow
+
+                bool broken() const noexcept { return type == FileType::none; }
+                bool isDirectory() const noexcept { return type == FileType::directory; }
+                bool isFile() const noexcept { return type == FileType::regular; }
+            };
+            static constexpr uint8_t maxHops = 40; // SYMLOOP_MAX on linux
+
+        private:
+            using Cache = std::map<std::string, Resolution, std::less<>>;
+            Cache iCurrent, iPrevious;
+            Resolution iUncached; // the last result when nothing is cached
+            size_t iCapacity;
+            size_t iHits = 0, iMisses = 0;
+
+            // the target of the soft link p, false if p is no soft link
+            static bool readLink(const std::string& p, std::string& target) {
+#ifdef __linux__
+                char buffer[PATH_MAX];
+                const ssize_t n = ::readlink(p.c_str(), buffer, sizeof(buffer));
+                if (n < 0) return false;
+                target.assign(buffer, size_t(n));
+                return true;
+#else
+                std::error_code ec;
+                auto link = std::filesystem::read_symlink(p, ec);
+                if (ec) return false;
+                target = link.string();
+                return true;
+#endif
+            }
+
+        public:
+            explicit LinkResolver(size_t capacity = 1 << 16) noexcept : iCapacity(capacity) {}
+
+            // resolves without the cache, the type comes from the kernel (a stat of p)
+            static Resolution follow(PathView p) {
+                Resolution r;
+                r.target = Path(p);
+                std::string current(p.view());
+                std::string target;
+                while (true) {
+                    while (current.size() > 1 && current.back() == '/') current.pop_back(); // the link itself
+                    if (!readLink(current, target)) break;
+                    if (r.hops == maxHops) {
+                        r.loop = true;
+                        break;
+                    }
+                    r.hops++;
+                    if (target.empty() || target[0] != '/') { // relative to the directory of the link
+                        const size_t slash = current.rfind('/');
+                        target.insert(0, current, 0, slash == std::string::npos ? 0 : slash + 1);
+                    }
+                    r.target = Path(std::move(target)).normalize();
+                    current = r.target.string();
+                }
+                const std::string path(p.view().empty() ? "." : p.view());
+#ifdef __linux__
+                struct stat st;
+                if (::stat(path.c_str(), &st) == 0) {
+                    r.type = fileTypeFromMode(st.st_mode);
+                } else {
+                    r.loop = r.loop || errno == ELOOP;
+                }
+#else
+                std::error_code ec;
+                auto st = std::filesystem::status(path, ec);
+                if (!ec && std::filesystem::exists(st)) r.type = fileTypeFromStatus(st);
+                r.loop = r.loop || ec == std::errc::too_many_symbolic_link_levels;
+#endif
+                if (r.loop) r.type = FileType::none;
+                return r;
+            }
+
+            // the reference is valid until the next call of resolve()
+            const Resolution& resolve(PathView p) {
+                const std::string_view key = p.view();
+                auto it = iCurrent.find(key);
+                if (it != iCurrent.end()) {
+                    iHits++;
+                    return it->second;
+                }
+                if (iCapacity == 0) {
+                    iMisses++;
+                    return iUncached = follow(p);
+                }
+                if (iCurrent.size() >= std::max<size_t>(1, iCapacity / 2)) {
+                    iPrevious = std::move(iCurrent);
+                    iCurrent.clear();
+                }
+                it = iPrevious.find(key);
+                if (it != iPrevious.end()) { // used again, keep it for another generation
+                    iHits++;
+                    return iCurrent.insert(iPrevious.extract(it)).position->second;
+                }
+                iMisses++;
+                return iCurrent.emplace(std::string(key), follow(p)).first->second;
+            }
+
+            // resolves every path of a range (vector, initializer_list, ...) of Path or PathView
+            template <class Range>
+            std::vector<Resolution> resolveAll(const Range& paths) {
+                std::vector<Resolution> result;
+                for (const auto& p : paths) result.push_back(resolve(p));
+                return result;
+            }
+
+            bool isDirectory(PathView p) { return resolve(p).isDirectory(); }
+            bool isFile(PathView p) { return resolve(p).isFile(); }
+
+            size_t size() const noexcept { return iCurrent.size() + iPrevious.size(); }
+            size_t capacity() const noexcept { return iCapacity; }
+            size_t hits() const noexcept { return iHits; }
+            size_t misses() const noexcept { return iMisses; }
+            void clear() noexcept {
+                iCurrent.clear();
+                iPrevious.clear();
+            }
+        };
+
+        // returns if it is a directory or a softlink to a directory, a broken soft link counts if its target ends
+        // with a separator
+        inline bool isSoftDirectory(const Path& p) {
+            const auto r = LinkResolver::follow(p);
+            return r.isDirectory() || (r.broken() && !r.loop && r.hops > 0 && !r.target.hasSuffix());
+        }
+
+        // returns if it is a regular file or a softlink to one, a broken soft link counts if its target does not end
+        // with a separator
+        inline bool isSoftFile(const Path& p) {
+            const auto r = LinkResolver::follow(p);
+            return r.isFile() || (r.broken() && !r.loop && r.hops > 0 && r.target.hasSuffix());
+        }
+
+        inline bool isSocket(const Path& p) { return std::filesystem::is_socket(p); }
+        inline void createHardLink(const Path& from, const Path& to) {
+            return std::filesystem::create_hard_link(from, to);
+        }
+        inline void createSoftLink(const Path& from, const Path& to) {
+            Path linkroot = to.removeEmptySuffix().splitSuffix().first;
+            std::filesystem::create_symlink(std::filesystem::relative(from, linkroot), to.removeEmptySuffix());
+        }
+        //from path will be relative (the way it is in the OS)
+        inline void createSoftLinkRelative(const Path& from, const Path& to) {
+            std::filesystem::create_symlink(from, to.removeEmptySuffix());
+        }
+
+        inline void createDirectories(const Path& p) {
+            ESTD_FILES_OPERATION(createDirectories, p);
+            std::filesystem::create_directories(p);
+        }
+        inline void createDirectory(const Path& p) { std::filesystem::create_directory(p); }
+
+        inline FileTime getModificationTime(const Path& p) { return std::filesystem::last_write_time(p); }
+        inline void setModificationTime(const Path& p, FileTime n) { std::filesystem::last_write_time(p, n); }
+
+        // fromStatus must describe `from` (see FileStatus), the destination is looked at once
+        inline void copySoftLink(
+            const Path& from, const FileStatus& fromStatus, const Path& to, const uint64_t opt = CopyOptions::none
+        ) {
+            ESTD_FILES_OPERATION(copySoftLink, from);
+            if (!fromStatus.isSoftLink()) throwError("copySoftLink: not a softlink", &from);
+            const bool toExists = FileStatus(to).exists();
             if (opt & CopyOptions::updateExisting) {
-                auto newTime = getModificationTime(from);
-                auto oldTime = getModificationTime(to);
-                if (newTime > oldTime) {
-                    if (exists(to) && !isDirectory(to)) remove(to);
+                if (toExists) {
+                    auto newTime = getModificationTime(from);
+                    auto oldTime = getModificationTime(to);
+                    if (newTime > oldTime) {
+                        remove(to);
+                        std::filesystem::copy_symlink(from, to);
+                    }
+                } else {
+                    std::filesystem::copy_symlink(from, to);
+                }
+            } else if (opt & CopyOptions::overwriteExisting) {
+                if (toExists) remove(to);
+                std::filesystem::copy_symlink(from, to);
+            } else if (opt & CopyOptions::skipExisting) {
+                if (!toExists) std::filesystem::copy_symlink(from, to);
+            } else {
+                if (!toExists) {
+                    std::filesystem::copy_symlink(from, to);
+                } else {
+                    throwError("copySoftLink cannot copy, entry exists", &to);
+                }
+            }
+        }
+        inline void copySoftLink(const Path& from, const Path& to, const uint64_t opt = CopyOptions::none) {
+            copySoftLink(from, FileStatus(from), to, opt);
+        }
+        inline void copyParallel(
+            const Path& from, const Path& to, const uint64_t opt = CopyOptions::recursive, size_t threads = 0
+        );
+
+        inline void copyBatched(const Path& from, const Path& to, const uint64_t opt = CopyOptions::recursive);
+
+        inline void copyDeduplicated(const Path& from, const Path& to, const uint64_t opt = CopyOptions::recursive);
+
+        namespace {
+            // copies the directory node itself (no children), returns true if the children should be copied
+            inline bool copyDirectoryNode(
+                const Path& from, const FileStatus& fromStatus, const Path& to, const uint64_t opt
+            ) {
+                if (from.isFile()) {
+                    throwError("copyDirectory cannot copy, from is not a directory", &from);
+                } else if (to.isFile()) {
+                    throwError("copyDirectory cannot copy, to is not a directory", &to);
+                }
+
+                if (!fromStatus.exists()) {
+                    throwError("copyDirectory trying to copy a directory that does not exist", &from);
+                }
+                if (!fromStatus.isDirectory()) throwError("copyDirectory trying to copy a file", &from);
+
+                const FileStatus toStatus(to);
+                if (toStatus.exists() && !toStatus.isDirectory()) {
+                    throwError("copyDirectory trying to copy to a file", &to);
+                }
+
+                if (opt & CopyOptions::updateExisting) {
+                    if (!toStatus.exists() || fromStatus.modificationTime() > toStatus.modificationTime()) {
+                        createDirectories(to); // copy_dir does not work
+                        setModificationTime(to, getModificationTime(from));
+                    }
+                } else if (opt & CopyOptions::overwriteExisting) {
                     createDirectories(to); // copy_dir does not work
-                    setModificationTime(to, newTime);
+                    setModificationTime(to, getModificationTime(from));
+                } else if (opt & CopyOptions::skipExisting) {
+                    if (!toStatus.exists()) createDirectories(to); // copy_dir does not work
+                } else {
+                    if (!toStatus.exists()) {
+                        createDirectories(to); // copy_dir does not work
+                    } else {
+                        throwError("copyDirectory cannot copy, entry exists", &to);
+                    }
+                }
+
+                // dir has been copied, `to` was a directory already or has just been created
+
+                return opt & CopyOptions::recursive;
+            }
+            inline bool copyDirectoryNode(const Path& from, const Path& to, const uint64_t opt) {
+                return copyDirectoryNode(from, FileStatus(from), to, opt);
+            }
+
+#ifdef __linux__
+            inline bool copyChildrenAt(const Path& from, const Path& to, const uint64_t opt);
+#endif
+        } // namespace
+
+        // fromStatus must describe `from` (see FileStatus), the children are copied with the status the directory
+        // listing provides
+        inline void copyDirectory(
+            const Path& from, const FileStatus& fromStatus, const Path& to, const uint64_t opt = CopyOptions::recursive
+        ) {
+            ESTD_FILES_OPERATION(copyDirectory, from);
+            if (opt & CopyOptions::dedupe) {
+                copyDeduplicated(from, to, opt);
+                return;
+            }
+            if (opt & CopyOptions::parallel) {
+                copyParallel(from, to, opt);
+                return;
+            }
+            if (opt & CopyOptions::ioUring) {
+                copyBatched(from, to, opt);
+                return;
+            }
+            if (!copyDirectoryNode(from, fromStatus, to, opt)) return;
+#ifdef __linux__
+            if (copyChildrenAt(from, to, opt)) return;
+#endif
+
+            estd::stack_ptr<std::runtime_error> err; // do not abort on a single error
+            const PrefixRewriter rewriter(from, to);
+            for (const auto& e : FastDirectoryIterator(from)) {
+                try {
+                    Path fromE = e.path();
+                    Path toE = rewriter.rewrite(fromE).value();
+
+                    copy(fromE, e.fileStatus(), toE, opt);
+                } catch (std::exception& tmp) {
+                    ESTD_FILES_COUNT(errorsSwallowed, 1);
+                    err = std::runtime_error(tmp.what());
+                }
+            }
+            if (err) throw err.value();
+        }
+        inline void copyDirectory(const Path& from, const Path& to, const uint64_t opt = CopyOptions::recursive) {
+            copyDirectory(from, FileStatus(from), to, opt);
+        }
+        namespace {
+#ifdef __linux__
+            // returns false if the kernel cannot do this copy and nothing was written
+            inline bool copyFileRange(int in, int out, off_t size) {
+                off_t done = 0;
+                while (done < size) {
+                    ESTD_FILES_COUNT(copyRange, 1);
+                    ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, size - done, 0);
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        if (done == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                                          errno == EOPNOTSUPP || errno == EPERM)) {
+                            return false;
+                        }
+                        throwError(std::string("copyFile copy_file_range failed: ") + std::strerror(errno));
+                    }
+                    if (n == 0) break; // file shrunk while copying
+                    ESTD_FILES_COUNT(bytesCopied, n);
+                    done += n;
+                }
+                return true;
+            }
+
+            inline bool sendFileRange(int in, int out, off_t size) {
+                off_t done = 0;
+                while (done < size) {
+                    ESTD_FILES_COUNT(copyRange, 1);
+                    ssize_t n = ::sendfile(out, in, nullptr, size - done);
+                    if (n < 0) {
+                        if (errno == EINTR || errno == EAGAIN) continue;
+                        if (done == 0 && (errno == ENOSYS || errno == EINVAL)) return false;
+                        throwError(std::string("copyFile sendfile failed: ") + std::strerror(errno));
+                    }
+                    if (n == 0) break;
+                    ESTD_FILES_COUNT(bytesCopied, n);
+                    done += n;
+                }
+                return true;
+            }
+
+            // moves the data between two open files in the kernel (reflink if asked for, copy_file_range,
+            // sendfile), returns false if none of them can do this copy or a clone was required and failed
+            inline bool copyFileContents(int in, int out, off_t size, const uint64_t opt) {
+                bool done = false;
+                if (opt & (CopyOptions::reflinkOnly | CopyOptions::reflinkPreferred)) {
+                    ESTD_FILES_COUNT(clone, 1);
+                    done = ::ioctl(out, FICLONE, in) == 0;
+                    if (done) ESTD_FILES_COUNT(bytesCopied, size);
+                }
+                if (!done && (opt & CopyOptions::reflinkOnly)) return false;
+                if (!done) done = copyFileRange(in, out, size);
+                if (!done) done = sendFileRange(in, out, size);
+                return done;
+            }
+#endif
+
+            // copies the file contents to `to`, which copyFile has already removed, on linux the data is moved by
+            // the kernel (reflink, copy_file_range, sendfile) before falling back to std::filesystem::copy_file
+            inline void copyFileData(
+                const Path& from, const Path& to, std::filesystem::copy_options sopt, const uint64_t opt
+            ) {
+                using sco = std::filesystem::copy_options;
+#ifdef __linux__
+                if (!(opt & (CopyOptions::copyAsHardLinks | CopyOptions::copyAsSoftLinks))) {
+                    ESTD_FILES_COUNT(open, 1);
+                    FileDescriptor in(::open(from.string().c_str(), O_RDONLY | O_CLOEXEC));
+                    struct stat fromSt;
+                    ESTD_FILES_COUNT(stat, 1);
+                    if (in && ::fstat(in, &fromSt) == 0 && S_ISREG(fromSt.st_mode)) {
+                        ESTD_FILES_COUNT(open, 1);
+                        FileDescriptor out(::open(
+                            to.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, fromSt.st_mode & 07777
+                        ));
+                        if (!out) throwError(std::string("copyFile cannot open: ") + std::strerror(errno), &to);
+                        ESTD_FILES_COUNT(metadata, 1);
+                        ::fchmod(out, fromSt.st_mode & 07777);
+
+                        bool done = copyFileContents(in, out, fromSt.st_size, opt);
+                        if (!done && (opt & CopyOptions::reflinkOnly)) {
+                            out.reset();
+                            ::unlink(to.string().c_str());
+                            throwError("copyFile cannot create a reflink", &from, &to);
+                        }
+                        if (done) return;
+                        sopt = (sopt & ~(sco::skip_existing | sco::update_existing)) | sco::overwrite_existing;
+                    }
+                }
+#endif
+                if (opt & CopyOptions::reflinkOnly) throwError("copyFile cannot create a reflink", &from, &to);
+                std::filesystem::copy_file(from, to, sopt);
+            }
+        } // namespace
+
+        // fromStatus must describe `from` (see FileStatus), the destination is looked at once
+        inline void copyFile(
+            const Path& from, const FileStatus& fromStatus, const Path& to, const uint64_t opt = CopyOptions::none
+        ) {
+            if (from.isFile() && to.isDirectory()) {
+                copyFile(from, fromStatus, to / from.getSuffix(), opt);
+                return;
+            }
+            ESTD_FILES_OPERATION(copyFile, from);
+            if (from.isDirectory()) throwError("copyFile cannot copy a directory", &from);
+            // At this point we can assume that from is a file and to is also a file (in terms of paths)
+
+            using sco = std::filesystem::copy_options;
+            sco sopt = sco::none;
+
+            if (opt & CopyOptions::overwriteExisting) {
+                sopt |= sco::overwrite_existing;
+            } else if (opt & CopyOptions::updateExisting) {
+                sopt |= sco::update_existing;
+            } else if (opt & CopyOptions::skipExisting) {
+                sopt |= sco::skip_existing;
+            }
+
+            if (opt & CopyOptions::directoriesOnly) { return; }
+            if (!(opt & CopyOptions::softLinksAsCopies)) { sopt |= sco::copy_symlinks; }
+            if (opt & CopyOptions::copyAsHardLinks) {
+                sopt |= sco::create_hard_links;
+            } else if (opt & CopyOptions::copyAsSoftLinks) {
+                sopt |= sco::create_symlinks;
+            }
+
+            if (fromStatus.isDirectory()) throwError("copyFile cannot copy expected a file got a directory", &from);
+            const FileStatus toStatus(to);
+            if (toStatus.isDirectory()) {
+                if (opt & CopyOptions::skipExisting) {
+                    return;
+                } else if (opt & CopyOptions::overwriteExisting) {
+                    remove(to);
+                    copyFileData(from, to, sopt, opt);
+                    return;
+                } else if (opt & CopyOptions::updateExisting) {
+                    if (getModificationTime(from) < getModificationTime(to)) return;
+                    remove(to);
+                    copyFileData(from, to, sopt, opt);
+                    return;
+                } else {
+                    throwError("copyFile cannot copy a file to replace a directory", &from);
+                }
+            }
+
+            if (toStatus.exists()) remove(to);
+            copyFileData(from, to, sopt, opt);
+        }
+        inline void copyFile(const Path& from, const Path& to, const uint64_t opt = CopyOptions::none) {
+            copyFile(from, FileStatus(from), to, opt);
+        }
+
+        namespace {
+#ifdef __linux__
+            // Recursive copy below two open directories, every kernel call is relative to the directory descriptors
+            // (fstatat, openat, mkdirat, symlinkat, unlinkat) so no path is resolved twice and renames above the
+            // walk do not redirect it. The common cases are handled here, everything else (existing destinations
+            // of another type, special files, failures of the fast path) goes to the path based functions with
+            // the full path so the semantics stay the same.
+            class RelativeTreeCopier {
+            private:
+                const uint64_t opt;
+                estd::stack_ptr<std::runtime_error> err; // do not abort on a single error
+
+                bool copyFileAt(
+                    int fromDir, int toDir, const RelativeName& name, const struct stat& st, bool toExists
+                ) {
+    #ifdef ESTD_FILES_INSTRUMENTATION
+                    const Path path = name.path();
+                    ESTD_FILES_OPERATION(copyFile, path);
+    #endif
+                    // copyFile replaces an existing file, it does not open it for writing
+                    ESTD_FILES_COUNT(unlink, toExists);
+                    if (toExists && ::unlinkat(toDir, name.name, 0) != 0) return false;
+                    ESTD_FILES_COUNT(open, 1);
+                    FileDescriptor in(::openat(fromDir, name.name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+                    if (!in) return false;
+                    ESTD_FILES_COUNT(open, 1);
+                    FileDescriptor out(
+                        ::openat(toDir, name.name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777)
+                    );
+                    if (!out) return false;
+                    ESTD_FILES_COUNT(metadata, 1);
+                    ::fchmod(out, st.st_mode & 07777);
+                    if (copyFileContents(in, out, st.st_size, opt)) return true;
+                    out.reset();
+                    ESTD_FILES_COUNT(unlink, 1);
+                    ::unlinkat(toDir, name.name, 0);
+                    return false;
+                }
+
+                bool copySoftLinkAt(int fromDir, int toDir, const RelativeName& name, const struct stat& st) {
+    #ifdef ESTD_FILES_INSTRUMENTATION
+                    const Path path = name.path();
+                    ESTD_FILES_OPERATION(copySoftLink, path);
+    #endif
+                    std::string target(size_t(st.st_size) + 1, '\0');
+                    while (true) {
+                        ESTD_FILES_COUNT(readLink, 1);
+                        ssize_t n = ::readlinkat(fromDir, name.name, &target[0], target.size());
+                        if (n < 0) return false;
+                        if (size_t(n) < target.size()) {
+                            target.resize(size_t(n));
+                            break;
+                        }
+                        target.resize(target.size() * 2); // the link changed since the stat
+                    }
+                    ESTD_FILES_COUNT(softLink, 1);
+                    return ::symlinkat(target.c_str(), toDir, name.name) == 0;
+                }
+
+                // copyDirectoryNode without paths
+                void copyDirectoryNodeAt(
+                    int toDir, const RelativeName& to, const struct stat& st, const struct stat* toSt
+                ) {
+                    const struct timespec times[2] = {{0, UTIME_OMIT}, st.st_mtim};
+                    bool setTime = opt & (CopyOptions::updateExisting | CopyOptions::overwriteExisting);
+                    if (toSt == nullptr) {
+                        ESTD_FILES_COUNT(makeDirectory, 1);
+                        if (::mkdirat(toDir, to.name, 0777) != 0) to.fail("copyDirectory cannot create: ", true);
+                    } else if (opt & CopyOptions::updateExisting) {
+                        setTime = st.st_mtim.tv_sec > toSt->st_mtim.tv_sec ||
+                                  (st.st_mtim.tv_sec == toSt->st_mtim.tv_sec &&
+                                   st.st_mtim.tv_nsec > toSt->st_mtim.tv_nsec);
+                    } else if (!(opt & (CopyOptions::overwriteExisting | CopyOptions::skipExisting))) {
+                        Path p = to.path(true);
+                        throwError("copyDirectory cannot copy, entry exists", &p);
+                    }
+                    ESTD_FILES_COUNT(metadata, setTime);
+                    if (setTime && ::utimensat(toDir, to.name, times, 0) != 0) {
+                        to.fail("cannot set the modification time: ", true);
+                    }
+                }
+
+                void copyEntry(int fromDir, int toDir, const RelativeName& from, const RelativeName& to) {
+                    struct stat st, toSt;
+                    ESTD_FILES_COUNT(stat, 2);
+                    if (::fstatat(fromDir, from.name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                        from.fail("cannot copy: ");
+                    }
+                    const bool toExists = ::fstatat(toDir, to.name, &toSt, AT_SYMLINK_NOFOLLOW) == 0;
+
+                    if (S_ISDIR(st.st_mode) && (!toExists || S_ISDIR(toSt.st_mode))) {
+                        copyDirectoryNodeAt(toDir, to, st, toExists ? &toSt : nullptr);
+                        ESTD_FILES_COUNT(open, 2);
+                        FileDescriptor fromFd(
+                            ::openat(fromDir, from.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+                        );
+                        if (!fromFd) from.fail("cannot open directory: ", true);
+                        FileDescriptor toFd(::openat(toDir, to.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+                        if (!toFd) to.fail("cannot open directory: ", true);
+                        copyChildren(fromFd, toFd, from, to);
+                        return;
+                    }
+                    if (S_ISREG(st.st_mode) && (!toExists || S_ISREG(toSt.st_mode))) {
+                        if (copyFileAt(fromDir, toDir, from, st, toExists)) return;
+                    } else if (S_ISLNK(st.st_mode) && !toExists) {
+                        if (copySoftLinkAt(fromDir, toDir, from, st)) return;
+                    }
+
+                    if (S_ISLNK(st.st_mode)) {
+                        copySoftLink(from.path(), to.path(), opt);
+                    } else {
+                        copy(from.path(S_ISDIR(st.st_mode)), to.path(S_ISDIR(st.st_mode)), opt);
+                    }
+                }
+
+            public:
+                explicit RelativeTreeCopier(const uint64_t opt) : opt(opt) {}
+
+                void copyChildren(int fromDir, int toDir, const RelativeName& from, const RelativeName& to) {
+                    bool listed = forEachDirent(fromDir, [&](const char* name, unsigned char) {
+                        try {
+                            copyEntry(fromDir, toDir, RelativeName{&from, name}, RelativeName{&to, name});
+                        } catch (std::exception& tmp) {
+                            ESTD_FILES_COUNT(errorsSwallowed, 1);
+                            err = std::runtime_error(tmp.what());
+                        }
+                    });
+                    if (!listed) from.fail("cannot read directory: ", true);
+                }
+
+                void rethrow() {
+                    if (err) throw err.value();
+                }
+            };
+
+            // copies the children of from into to (both exist), false if the directories cannot be opened or the
+            // options need the path based copy
+            inline bool copyChildrenAt(const Path& from, const Path& to, const uint64_t opt) {
+                const uint64_t pathOnly =
+                    CopyOptions::copyAsSoftLinks | CopyOptions::copyAsHardLinks | CopyOptions::directoriesOnly;
+                if (opt & pathOnly) return false;
+                const std::string fromRoot = from.string(), toRoot = to.string();
+                ESTD_FILES_COUNT(open, 2);
+                FileDescriptor fromFd(
+                    ::open(fromRoot.empty() ? "." : fromRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+                );
+                FileDescriptor toFd(::open(toRoot.empty() ? "." : toRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+                if (!fromFd || !toFd) return false;
+
+                RelativeTreeCopier copier(opt);
+                const RelativeName fromName{nullptr, fromRoot.c_str()}, toName{nullptr, toRoot.c_str()};
+                copier.copyChildren(fromFd, toFd, fromName, toName);
+                copier.rethrow();
+                return true;
+            }
+#endif
+        } // namespace
+
+        inline void rename(const Path& from, const Path& to) {
+            if (from.isDirectory() != isDirectory(from)) {
+                if (from.isDirectory()) {
+                    throwError("cannot rename: source not a directory", &from);
+                } else {
+                    throwError("cannot rename: source not a file", &from);
+                }
+            }
+            if (from.isDirectory() != to.isDirectory()) {
+                if (from.isDirectory()) {
+                    throwError("cannot rename: destination not a directory", &from);
+                } else {
+                    throwError("cannot rename: destination not a file", &from);
+                }
+            }
+            if (std::rename(from.string().c_str(), to.string().c_str()) != 0) {
+                throwError("Failed to rename: source file ", &from);
+            }
+        }
+
+#ifdef __linux__
+        // Anonymous file created with O_TMPFILE in `directory`: it has no name until link() gives it one and is gone
+        // with the descriptor otherwise, so a half written file is never visible. Where the filesystem does not
+        // support O_TMPFILE, or with `named`, it is a hidden named file that link() renames and the destructor (or
+        // a move assignment over it) unlinks. The mode is subject to the umask.
+        class TmpFile {
+        private:
+            FileDescriptor iFd;
+            std::string iName; // only without O_TMPFILE
+            bool iLinked = false;
+
+        public:
+            explicit TmpFile(const Path& directory = "./", mode_t mode = 0600, bool named = false) {
+                std::string dir = directory.string().empty() ? "./" : directory.string();
+                if (!named) {
+                    iFd.reset(::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, mode));
+                    if (iFd) return;
+                }
+                if (!named && errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL) {
+                    throwError(std::string("cannot create a temporary file: ") + std::strerror(errno), &directory);
+                }
+                if (dir.back() != '/') dir += '/';
+                do {
+                    iName = dir + ".tmp_" + estd::string_util::gen_random(8);
+                    iFd.reset(::open(iName.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode));
+                } while (!iFd && errno == EEXIST);
+                if (!iFd) {
+                    iName.clear();
+                    throwError(std::string("cannot create a temporary file: ") + std::strerror(errno), &directory);
+                }
+            }
+            TmpFile(TmpFile&& other) noexcept
+                : iFd(std::move(other.iFd)), iName(std::exchange(other.iName, {})), iLinked(other.iLinked) {}
+            TmpFile& operator=(TmpFile&& other) noexcept {
+                if (this != &other) {
+                    if (!iName.empty() && !iLinked) ::unlink(iName.c_str());
+                    iFd = std::move(other.iFd);
+                    iName = std::exchange(other.iName, {});
+                    iLinked = other.iLinked;
+                }
+                return *this;
+            }
+            ~TmpFile() {
+                if (!iName.empty() && !iLinked) ::unlink(iName.c_str());
+            }
+
+            int fd() const noexcept { return iFd.get(); }
+            bool linked() const noexcept { return iLinked; }
+
+            void write(std::string_view data) {
+                while (!data.empty()) {
+                    ssize_t n = ::write(iFd, data.data(), data.size());
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n < 0) throwError(std::string("TmpFile cannot write: ") + std::strerror(errno));
+                    data.remove_prefix(size_t(n));
+                }
+            }
+
+            // fsync, before link() if the contents have to be durable under the new name
+            void sync() {
+                if (::fsync(iFd) != 0) throwError(std::string("TmpFile cannot sync: ") + std::strerror(errno));
+            }
+
+            // gives the file the name `to` (on the same filesystem), an existing entry is only replaced if asked
+            // for, in that case atomically
+            void link(const Path& to, bool replace = false) {
+                if (iLinked) throwError("TmpFile is already linked", &to);
+                const std::string target = to.string();
+                if (!iName.empty()) { // named fallback, a rename does it
+                    if (!replace && exists(to)) throwError("TmpFile cannot link, entry exists", &to);
+                    if (std::rename(iName.c_str(), target.c_str()) != 0) {
+                        throwError(std::string("TmpFile cannot link: ") + std::strerror(errno), &to);
+                    }
+                    iLinked = true;
+                    return;
+                }
+                const std::string self = "/proc/self/fd/" + std::to_string(iFd.get());
+                std::string name = replace ? target + ".tmp_" + estd::string_util::gen_random(8) : target;
+                if (::linkat(AT_FDCWD, self.c_str(), AT_FDCWD, name.c_str(), AT_SYMLINK_FOLLOW) != 0) {
+                    throwError(std::string("TmpFile cannot link: ") + std::strerror(errno), &to);
+                }
+                if (replace && std::rename(name.c_str(), target.c_str()) != 0) {
+                    int error = errno;
+                    ::unlink(name.c_str());
+                    throwError(std::string("TmpFile cannot link: ") + std::strerror(error), &to);
+                }
+                iLinked = true;
+            }
+        };
+#endif
+
+        // Whole file contents, the buffer is sized once from fstat and a regular file is usually read with a single
+        // read (files that report no size, like the ones in /proc, are read in growing chunks). The overload reuses
+        // the capacity of the caller's buffer and returns the size.
+        inline size_t readFile(PathView p, std::string& buffer) {
+            const std::string path(p.view());
+#ifdef __linux__
+            FileDescriptor fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+            if (!fd) {
+                Path err = path;
+                throwError(std::string("readFile cannot open: ") + std::strerror(errno), &err);
+            }
+            struct stat st;
+            const size_t expected = ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? size_t(st.st_size) : 0;
+            buffer.resize(expected != 0 ? expected : 4096);
+            size_t size = 0;
+            while (true) {
+                if (size == buffer.size()) {
+                    if (size == expected) break; // trust fstat, no extra read to find the end
+                    buffer.resize(size * 2);
+                }
+                ssize_t n = ::read(fd, &buffer[size], buffer.size() - size);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    Path err = path;
+                    throwError(std::string("readFile cannot read: ") + std::strerror(errno), &err);
+                }
+                if (n == 0) break;
+                size += size_t(n);
+            }
+            buffer.resize(size);
+            return size;
+#else
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                Path err = path;
+                throwError("readFile cannot open", &err);
+            }
+            buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            return buffer.size();
+#endif
+        }
+        inline std::string readFile(PathView p) {
+            std::string buffer;
+            readFile(p, buffer);
+            return buffer;
+        }
+
+        enum class SyncPolicy {
+            none,            // the rename is atomic but may be lost or reordered with the data on a crash
+            file,            // fsync the data before the rename
+            fileAndDirectory // and fsync the directory after it, the new contents survive a crash
+        };
+
+        // Replaces the file with `data` without a moment where it is missing or partly written: the data goes to an
+        // anonymous O_TMPFILE (or a hidden sibling file) in the same directory that is then renamed over the
+        // target. An existing file keeps its permissions, a new one gets 0666 minus the umask.
+        inline void writeFileAtomic(PathView p, std::string_view data, SyncPolicy sync = SyncPolicy::none) {
+            const Path target(p);
+            std::string directory = std::string(target.view().substr(0, target.view().find_last_of('/') + 1));
+            if (directory.empty()) directory = "./";
+#ifdef __linux__
+            TmpFile file(directory, 0666);
+            struct stat st;
+            if (::stat(target.string().c_str(), &st) == 0) ::fchmod(file.fd(), st.st_mode & 07777);
+            file.write(data);
+            if (sync != SyncPolicy::none) file.sync();
+            file.link(target, true);
+            if (sync == SyncPolicy::fileAndDirectory) {
+                FileDescriptor dir(::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+                if (!dir || ::fsync(dir) != 0) {
+                    throwError(std::string("writeFileAtomic cannot sync: ") + std::strerror(errno), &target);
+                }
+            }
+#else
+            (void)sync;
+            const std::string tmp = directory + ".tmp_" + estd::string_util::gen_random(8);
+            {
+                std::ofstream out(tmp, std::ios::binary);
+                out.write(data.data(), std::streamsize(data.size()));
+                if (!out) throwError("writeFileAtomic cannot write", &target);
+            }
+            if (std::rename(tmp.c_str(), target.string().c_str()) != 0) {
+                std::remove(tmp.c_str());
+                throwError("writeFileAtomic cannot rename", &target);
+            }
+#endif
+        }
+
+        // fromStatus must describe from.removeEmptySuffix() (see FileStatus), a directory listing provides it
+        inline void copy(const Path& from, const FileStatus& fromStatus, const Path& to, const uint64_t opt) {
+            ESTD_FILES_OPERATION(copy, from);
+            if (!fromStatus.exists()) throwError("cannot copy: No such file or directory", &from);
+
+            if (from.isDirectory() != fromStatus.isDirectory()) {
+                if (from.isDirectory()) {
+                    throwError("cannot copy: source not a directory", &from);
+                } else {
+                    throwError("cannot copy: source not a file", &from);
+                }
+            }
+
+            try {
+                if (fromStatus.isSoftLink()) {
+                    // std::cout << "copy_symlink(" << from << ", " << to << ")\n";
+                    copySoftLink(from.removeEmptySuffix(), fromStatus, to.removeEmptySuffix(), opt);
+                } else if (from.isFile()) { // TODO: test strange files such as sockets and blocks under this if
+                    // std::cout << "copy_file(" << from << ", " << to << ")\n";
+                    copyFile(from, fromStatus, to, opt);
+                } else if (from.isDirectory()) {
+                    // std::cout << "copy_dir(" << from << ", " << to << ")\n";
+                    copyDirectory(from, fromStatus, to.addEmptySuffix(), opt);
+                }
+            } catch (std::exception& e) { throw std::runtime_error(e.what()); }
+        }
+        inline void copy(const Path& from, const Path& to, const uint64_t opt) {
+            copy(from, FileStatus(from.removeEmptySuffix()), to, opt);
+        }
+
+        // Same semantics as copy() with CopyOptions::recursive, but directory listings and entry copies run on a work
+        // stealing pool of `threads` workers (0 = hardware concurrency). Errors do not stop the copy, the last one is
+        // rethrown once everything that could be copied was copied.
+        inline void copyParallel(const Path& from, const Path& toPath, const uint64_t opt, size_t threads) {
+            const uint64_t childOpt = opt & ~uint64_t(CopyOptions::parallel);
+            if (!from.isDirectory() || isSoftLink(from.removeEmptySuffix())) {
+                copy(from, toPath, childOpt);
+                return;
+            }
+            Path to = toPath.addEmptySuffix();
+
+            std::mutex errMutex;
+            estd::stack_ptr<std::runtime_error> err; // do not abort on a single error
+            auto setError = [&](const std::exception& e) {
+                std::lock_guard<std::mutex> lk(errMutex);
+                err = std::runtime_error(e.what());
+            };
+
+            WorkStealingPool pool(threads);
+            std::function<void(Path, Path)> expand; // copies the children of an already copied directory
+            expand = [&](Path from, Path to) {
+                try {
+                    const PrefixRewriter rewriter(from, to);
+                    for (const auto& e : FastDirectoryIterator(from)) {
+                        try {
+                            Path fromE = e.path();
+                            Path toE = rewriter.rewrite(fromE).value();
+                            if (e.isDirectory() && !e.isSoftLink()) {
+                                pool.submit([&, fromE, toE]() mutable {
+                                    try {
+                                        if (copyDirectoryNode(fromE, toE, childOpt)) expand(fromE, toE);
+                                    } catch (std::exception& tmp) { setError(tmp); }
+                                });
+                            } else {
+                                pool.submit([&, fromE, toE] {
+                                    try {
+                                        copy(fromE, toE, childOpt);
+                                    } catch (std::exception& tmp) { setError(tmp); }
+                                });
+                            }
+                        } catch (std::exception& tmp) { setError(tmp); }
+                    }
+                } catch (std::exception& tmp) { setError(tmp); }
+            };
+
+            if (!copyDirectoryNode(from, to, childOpt)) return; // errors on the root are thrown directly
+            pool.submit([&] { expand(from, to); });
+            pool.wait();
+            if (err) throw err.value();
+        }
+
+#ifdef ESTD_FILES_HAS_IO_URING
+        // Minimal io_uring submission/completion ring on raw syscalls (no liburing).
+        class IoUring {
+        private:
+            FileDescriptor ring;
+            void* sqRing = MAP_FAILED;
+            void* cqRing = MAP_FAILED;
+            io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+            size_t sqRingSize = 0;
+            size_t cqRingSize = 0;
+            size_t sqesSize = 0;
+
+            unsigned* sqHead = nullptr;
+            unsigned* sqTail = nullptr;
+            unsigned* sqArray = nullptr;
+            unsigned sqMask = 0;
+            unsigned* cqHead = nullptr;
+            unsigned* cqTail = nullptr;
+            io_uring_cqe* cqes = nullptr;
+            unsigned cqMask = 0;
+
+            unsigned entries = 0;
+            unsigned localTail = 0; // sqes handed out, published to the kernel by submit()
+
+            template <class T>
+            static T* at(void* base, unsigned offset) {
+                return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+            }
+
+            void unmap() noexcept {
+                if (sqes != MAP_FAILED) ::munmap(sqes, sqesSize);
+                if (cqRing != MAP_FAILED) ::munmap(cqRing, cqRingSize);
+                if (sqRing != MAP_FAILED) ::munmap(sqRing, sqRingSize);
+                sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+                cqRing = sqRing = MAP_FAILED;
+            }
+
+        public:
+            explicit IoUring(unsigned queueDepth = 256) {
+                io_uring_params params;
+                std::memset(&params, 0, sizeof(params));
+                ring.reset(int(::syscall(__NR_io_uring_setup, queueDepth, &params)));
+                if (!ring) throwError(std::string("io_uring_setup failed: ") + std::strerror(errno));
+                entries = params.sq_entries;
+
+                sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+                int prot = PROT_READ | PROT_WRITE;
+                sqRing = ::mmap(nullptr, sqRingSize, prot, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+                cqRing = ::mmap(nullptr, cqRingSize, prot, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+                sqes = static_cast<io_uring_sqe*>(
+                    ::mmap(nullptr, sqesSize, prot, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES)
+                );
+                if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+                    int e = errno;
+                    unmap();
+                    throwError(std::string("io_uring mmap failed: ") + std::strerror(e));
+                }
+
+                sqHead = at<unsigned>(sqRing, params.sq_off.head);
+                sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+                sqArray = at<unsigned>(sqRing, params.sq_off.array);
+                sqMask = *at<unsigned>(sqRing, params.sq_off.ring_mask);
+                cqHead = at<unsigned>(cqRing, params.cq_off.head);
+                cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+                cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+                cqMask = *at<unsigned>(cqRing, params.cq_off.ring_mask);
+                localTail = *sqTail;
+            }
+            IoUring(const IoUring&) = delete;
+            IoUring& operator=(const IoUring&) = delete;
+            ~IoUring() { unmap(); }
+
+            // true if the kernel lets this process create a ring (it may be compiled out or disabled by policy)
+            static bool available() {
+                static const bool result = [] {
+                    try {
+                        IoUring probe(2);
+                        return true;
+                    } catch (...) { return false; }
+                }();
+                return result;
+            }
+
+            unsigned capacity() const noexcept { return entries; }
+
+            // next free submission entry, zeroed, nullptr if the queue is full until the next submit()
+            io_uring_sqe* prepare(uint8_t opcode, int fd, uint64_t addr, uint32_t len, uint64_t off, uint64_t data) {
+                unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+                if (localTail - head >= entries) return nullptr;
+                unsigned index = localTail & sqMask;
+                io_uring_sqe* sqe = &sqes[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = opcode;
+                sqe->fd = fd;
+                sqe->addr = addr;
+                sqe->len = len;
+                sqe->off = off;
+                sqe->user_data = data;
+                sqArray[index] = index;
+                localTail++;
+                return sqe;
+            }
+
+            // publishes prepared entries and optionally blocks until `waitFor` completions are available
+            void submit(unsigned waitFor = 0) {
+                unsigned toSubmit = localTail - *sqTail;
+                __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+                while (true) {
+                    long n = ::syscall(
+                        __NR_io_uring_enter,
+                        ring.get(),
+                        toSubmit,
+                        waitFor,
+                        waitFor ? IORING_ENTER_GETEVENTS : 0,
+                        nullptr,
+                        0
+                    );
+                    if (n >= 0) return;
+                    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        throwError(std::string("io_uring_enter failed: ") + std::strerror(errno));
+                    }
+                    toSubmit = localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+                }
+            }
+
+            // takes one completion if there is one
+            bool pop(io_uring_cqe& cqe) {
+                unsigned head = *cqHead;
+                if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return false;
+                cqe = cqes[head & cqMask];
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+
+            // blocks for one completion, submitting anything prepared
+            void wait(io_uring_cqe& cqe) {
+                while (!pop(cqe)) submit(1);
+            }
+        };
+
+        namespace {
+            // copies regular files in batches, every file is a small state machine driven by completions:
+            // statx + open source -> open destination (O_EXCL) -> read/write chunks -> close both
+            class BatchedFileCopier {
+            private:
+                enum Op : uint64_t { statxOp, openFromOp, openToOp, readOp, writeOp, closeOp };
+
+                struct Job {
+                    std::string from, to;
+                    int src = -1;
+                    int dst = -1;
+                    struct statx stx;
+                    uint64_t offset = 0;
+                    uint32_t chunk = 0;   // bytes of the current write
+                    uint32_t written = 0; // bytes of the current chunk already written
+                    std::unique_ptr<char[]> buffer;
+                    uint32_t bufferSize = 0;
+                    int pending = 0;
+                    bool closing = false;
+                    bool fallback = false; // let the blocking copyFile decide (destination exists, op unsupported)
+                    estd::stack_ptr<std::runtime_error> error;
+                };
+
+                IoUring ring;
+                std::vector<Job> jobs;
+                uint64_t opt;
+                std::function<void(const std::exception&)> setError;
+                static constexpr size_t window = 64; // files in flight, two ops each at most
+                static constexpr uint32_t chunkSize = 1 << 17;
+
+                io_uring_sqe*
+                prepare(size_t job, Op op, uint8_t opcode, int fd, uint64_t addr, uint32_t len, uint64_t off) {
+                    io_uring_sqe* sqe = ring.prepare(opcode, fd, addr, len, off, (uint64_t(job) << 3) | op);
+                    while (sqe == nullptr) {
+                        ring.submit();
+                        sqe = ring.prepare(opcode, fd, addr, len, off, (uint64_t(job) << 3) | op);
+                    }
+                    jobs[job].pending++;
+                    return sqe;
+                }
+
+                void fail(Job& j, const char* what, int res) {
+                    if (!j.error) {
+                        Path from = j.from, to = j.to;
+                        try {
+                            throwError(std::string("copyFile ") + what + ": " + std::strerror(-res), &from, &to);
+                        } catch (std::exception& e) { j.error = std::runtime_error(e.what()); }
+                    }
+                }
+
+                void read(size_t id) {
+                    Job& j = jobs[id];
+                    uint64_t left = j.stx.stx_size - j.offset;
+                    j.chunk = uint32_t(std::min<uint64_t>(left, j.bufferSize));
+                    j.written = 0;
+                    prepare(id, readOp, IORING_OP_READ, j.src, uint64_t(j.buffer.get()), j.chunk, j.offset);
+                }
+
+                void write(size_t id) {
+                    Job& j = jobs[id];
+                    prepare(
+                        id,
+                        writeOp,
+                        IORING_OP_WRITE,
+                        j.dst,
+                        uint64_t(j.buffer.get() + j.written),
+                        j.chunk - j.written,
+                        j.offset + j.written
+                    );
+                }
+
+                void close(size_t id) {
+                    Job& j = jobs[id];
+                    j.closing = true;
+                    if (j.src >= 0) prepare(id, closeOp, IORING_OP_CLOSE, j.src, 0, 0, 0);
+                    if (j.dst >= 0) prepare(id, closeOp, IORING_OP_CLOSE, j.dst, 0, 0, 0);
+                    j.src = j.dst = -1;
+                }
+
+                // returns true when the job is finished
+                bool complete(size_t id, Op op, int res) {
+                    Job& j = jobs[id];
+                    j.pending--;
+                    bool unsupported = res == -EINVAL || res == -EOPNOTSUPP || res == -ENOSYS;
+                    switch (op) {
+                        case statxOp:
+                            if (unsupported) j.fallback = true;
+                            else if (res < 0) fail(j, "cannot stat source", res);
+                            else if (!S_ISREG(j.stx.stx_mode)) j.fallback = true;
+                            break;
+                        case openFromOp:
+                            if (res >= 0) j.src = res;
+                            else if (unsupported) j.fallback = true;
+                            else fail(j, "cannot open source", res);
+                            break;
+                        case openToOp:
+                            if (res >= 0) {
+                                j.dst = res;
+                                ::fchmod(res, j.stx.stx_mode & 07777); // the open mode went through the umask
+                                if (j.stx.stx_size == 0) break;
+                                j.bufferSize = uint32_t(std::min<uint64_t>(j.stx.stx_size, chunkSize));
+                                j.buffer.reset(new char[j.bufferSize]);
+                                read(id);
+                                return false;
+                            }
+                            if (res == -EEXIST || unsupported) j.fallback = true;
+                            else fail(j, "cannot open destination", res);
+                            break;
+                        case readOp:
+                            if (res < 0) {
+                                fail(j, "read failed", res);
+                            } else if (res > 0) {
+                                j.chunk = uint32_t(res);
+                                write(id);
+                                return false;
+                            }
+                            break; // file shrunk while copying
+                        case writeOp:
+                            if (res <= 0) {
+                                fail(j, "write failed", res < 0 ? res : -EIO);
+                                break;
+                            }
+                            j.written += uint32_t(res);
+                            if (j.written < j.chunk) {
+                                write(id);
+                                return false;
+                            }
+                            j.offset += j.chunk;
+                            if (j.offset < j.stx.stx_size) {
+                                read(id);
+                                return false;
+                            }
+                            break;
+                        case closeOp: break;
+                    }
+                    if (j.pending > 0) return false; // statx and open source run together
+                    if (!j.closing && op <= openFromOp && !j.fallback && !j.error) {
+                        prepare(
+                            id,
+                            openToOp,
+                            IORING_OP_OPENAT,
+                            AT_FDCWD,
+                            uint64_t(j.to.c_str()),
+                            j.stx.stx_mode & 07777,
+                            0
+                        )->open_flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+                        return false;
+                    }
+                    if (!j.closing) {
+                        close(id);
+                        if (j.pending > 0) return false;
+                    }
+                    finish(j);
+                    return true;
+                }
+
+                void finish(Job& j) {
+                    j.buffer.reset();
+                    try {
+                        if (j.fallback) copyFile(j.from, j.to, opt & ~uint64_t(CopyOptions::ioUring));
+                    } catch (std::exception& e) { setError(e); }
+                    if (j.error) setError(j.error.value());
+                }
+
+                void start(size_t id) {
+                    Job& j = jobs[id];
+                    uint64_t path = uint64_t(j.from.c_str());
+                    uint32_t mask = STATX_MODE | STATX_SIZE;
+                    prepare(id, statxOp, IORING_OP_STATX, AT_FDCWD, path, mask, uint64_t(&j.stx))->statx_flags =
+                        AT_STATX_SYNC_AS_STAT;
+                    prepare(id, openFromOp, IORING_OP_OPENAT, AT_FDCWD, path, 0, 0)->open_flags = O_RDONLY | O_CLOEXEC;
+                }
+
+            public:
+                BatchedFileCopier(uint64_t opt, std::function<void(const std::exception&)> setError) :
+                    ring(256), opt(opt), setError(setError) {}
+
+                // blocking directory pass that creates the tree and queues the files
+                void plan(const Path& from, const Path& to) {
+                    const PrefixRewriter rewriter(from, to);
+                    for (const auto& e : FastDirectoryIterator(from)) {
+                        try {
+                            Path toE = rewriter.rewrite(e.path()).value();
+                            if (e.isSoftLink() || (e.type() != FileType::regular && e.type() != FileType::directory)) {
+                                copy(e.path(), toE, opt);
+                            } else if (e.isDirectory()) {
+                                if (copyDirectoryNode(e.path(), toE, opt)) plan(e.path(), toE);
+                            } else {
+                                jobs.emplace_back();
+                                jobs.back().from = e.path().string();
+                                jobs.back().to = toE.string();
+                            }
+                        } catch (std::exception& tmp) { setError(tmp); }
+                    }
+                }
+
+                void run() {
+                    size_t next = 0;
+                    size_t active = 0;
+                    io_uring_cqe cqe;
+                    while (next < jobs.size() || active > 0) {
+                        for (; active < window && next < jobs.size(); next++, active++) start(next);
+                        ring.wait(cqe);
+                        if (complete(size_t(cqe.user_data >> 3), Op(cqe.user_data & 7), cqe.res)) active--;
+                    }
+                }
+            };
+        } // namespace
+#endif
+
+        // Copies like copy(from, to, opt) but regular file data moves through batched io_uring submissions.
+        // Directories and soft links are created with the blocking calls, files whose destination already exists
+        // (or that the ring cannot handle) go through copyFile, so every CopyOptions keeps its meaning.
+        // Without io_uring (other platforms, old kernels, disabled by policy) this is copy().
+        inline void copyBatched(const Path& from, const Path& to, const uint64_t opt) {
+            const uint64_t plainOpt = opt & ~uint64_t(CopyOptions::ioUring);
+#ifdef ESTD_FILES_HAS_IO_URING
+            const uint64_t blocking = CopyOptions::directoriesOnly | CopyOptions::copyAsHardLinks |
+                                      CopyOptions::copyAsSoftLinks | CopyOptions::reflinkOnly |
+                                      CopyOptions::reflinkPreferred;
+            if (!(opt & blocking) && (opt & CopyOptions::recursive) && from.isDirectory() &&
+                !isSoftLink(from.removeEmptySuffix()) && IoUring::available()) {
+                estd::stack_ptr<std::runtime_error> err; // do not abort on a single error
+                auto setError = [&](const std::exception& e) { err = std::runtime_error(e.what()); };
+                BatchedFileCopier copier(plainOpt, setError);
+                Path root = to.addEmptySuffix();
+                if (!copyDirectoryNode(from, root, plainOpt)) return; // errors on the root are thrown directly
+                try {
+                    copier.plan(from, root);
+                } catch (std::exception& tmp) { setError(tmp); }
+                copier.run();
+                if (err) throw err.value();
+                return;
+            }
+#endif
+            copy(from, to, plainOpt);
+        }
+
+        // remove() with the directories listed and emptied concurrently on a work stealing pool of `threads` workers
+        // (0 = hardware concurrency), every call is relative to an open directory. A directory is removed by the
+        // worker that finishes its last subdirectory. Errors do not stop the removal, the last one is rethrown.
+        inline uintmax_t removeParallel(const Path& p, size_t threads = 0) {
+#ifdef __linux__
+            const std::string root = p.removeEmptySuffix().string();
+            if (root.empty()) return remove(p);
+            if (::unlinkat(AT_FDCWD, root.c_str(), 0) == 0) return 1; // files and soft links go at once
+            if (errno == ENOENT) return 0;
+            if (errno != EISDIR) RelativeName{nullptr, root.c_str()}.fail("cannot remove: ");
+
+            struct Directory {
+                std::shared_ptr<Directory> parent;
+                std::string name; // in the parent, the whole root path for the root
+                FileDescriptor fd;
+                std::atomic<size_t> pending{1}; // its own listing plus one per subdirectory not removed yet
+
+                int parentFd() const { return parent ? parent->fd.get() : AT_FDCWD; }
+                Path path(const char* child = nullptr) const {
+                    std::string p = child == nullptr ? name + "/" : name + "/" + child;
+                    for (const Directory* d = parent.get(); d != nullptr; d = d->parent.get()) p = d->name + "/" + p;
+                    return p;
+                }
+            };
+
+            std::mutex errMutex;
+            estd::stack_ptr<std::runtime_error> err;
+            auto fail = [&](const char* what, const Path& path, int error) {
+                std::lock_guard<std::mutex> lk(errMutex);
+                err = std::runtime_error(
+                    std::string("filesystem error: ") + what + std::strerror(error) + " [" + path.string() + "]"
+                );
+            };
+            std::atomic<uintmax_t> count{0};
+            WorkStealingPool pool(threads);
+
+            // drops one pending reference, the last one removes the directory and moves up to the parent
+            auto release = [&](std::shared_ptr<Directory> d) {
+                for (; d && --d->pending == 0; d = d->parent) {
+                    d->fd.reset();
+                    if (::unlinkat(d->parentFd(), d->name.c_str(), AT_REMOVEDIR) == 0) {
+                        count++;
+                    } else if (errno != ENOENT) {
+                        int error = errno;
+                        fail("cannot remove: ", d->path(), error);
+                    }
+                }
+            };
+            std::function<void(std::shared_ptr<Directory>)> empty;
+            empty = [&](std::shared_ptr<Directory> d) {
+                d->fd.reset(::openat(d->parentFd(), d->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+                if (!d->fd) {
+                    int error = errno;
+                    if ((error == ENOTDIR || error == ELOOP) && ::unlinkat(d->parentFd(), d->name.c_str(), 0) == 0) {
+                        count++; // replaced by a file since it was listed
+                    } else if (error != ENOENT) {
+                        fail("cannot open directory: ", d->path(), error);
+                    }
+                    release(d->parent); // nothing left to remove here, the parent still waits for this one
+                    return;
+                }
+                auto subdirectory = [&](const char* name) {
+                    auto child = std::make_shared<Directory>();
+                    child->parent = d;
+                    child->name = name;
+                    d->pending++;
+                    pool.submit([&empty, child] { empty(child); });
+                };
+                bool listed = forEachDirent(d->fd, [&](const char* name, unsigned char type) {
+                    if (type == DT_DIR) {
+                        subdirectory(name);
+                    } else if (::unlinkat(d->fd, name, 0) == 0) {
+                        count++;
+                    } else if (errno == EISDIR) {
+                        subdirectory(name);
+                    } else if (errno != ENOENT) {
+                        int error = errno;
+                        fail("cannot remove: ", d->path(name), error);
+                    }
+                });
+                if (!listed && errno != ENOENT) { // ENOENT: removed by someone else after the open
+                    int error = errno;
+                    fail("cannot read directory: ", d->path(), error);
+                }
+                release(d);
+            };
+
+            auto rootDirectory = std::make_shared<Directory>();
+            rootDirectory->name = root;
+            pool.submit([&empty, rootDirectory] { empty(rootDirectory); });
+            pool.wait();
+            if (err) throw err.value();
+            return count;
+#else
+            (void)threads;
+            return remove(p);
+#endif
+        }
+
+        namespace detail {
+            // renamed trees waiting to be removed by one background thread, the thread is never joined, at exit the
+            // queue is finished and later requests remove synchronously. In a named namespace so every translation
+            // unit shares the one instance (and thread) behind instance().
+            class DeferredRemover {
+            private:
+                std::mutex m;
+                std::condition_variable wake, idle;
+                std::deque<Path> queue;
+                bool busy = false;
+                bool exiting = false;
+
+                DeferredRemover() {
+                    std::thread([this] { run(); }).detach();
+                    std::atexit([] { instance().flush(true); });
+                }
+
+                void run() {
+                    std::unique_lock<std::mutex> lk(m);
+                    while (true) {
+                        wake.wait(lk, [&] { return !queue.empty(); });
+                        Path p = std::move(queue.front());
+                        queue.pop_front();
+                        busy = true;
+                        lk.unlock();
+                        try {
+                            remove(p);
+                            std::error_code ec;
+                            std::filesystem::remove(p.splitSuffix().first.string(), ec); // the trash, if empty
+                        } catch (std::exception&) {} // nobody left to report to
+                        lk.lock();
+                        busy = false;
+                        if (queue.empty()) idle.notify_all();
+                    }
+                }
+
+            public:
+                static DeferredRemover& instance() {
+                    static DeferredRemover* remover = new DeferredRemover(); // outlives every static destructor
+                    return *remover;
+                }
+
+                // false if the process is exiting and the caller has to remove it
+                bool push(Path p) {
+                    {
+                        std::lock_guard<std::mutex> lk(m);
+                        if (exiting) return false;
+                        queue.push_back(std::move(p));
+                    }
+                    wake.notify_one();
+                    return true;
+                }
+
+                void flush(bool exit = false) {
+                    std::unique_lock<std::mutex> lk(m);
+                    exiting = exiting || exit;
+                    idle.wait(lk, [&] { return queue.empty() && !busy; });
+                }
+            };
+        } // namespace detail
+
+        // Moves the entry into a hidden trash directory and returns, a background thread removes it later. The trash
+        // is ".estd_trash/" next to the entry unless `trashParent` says where to create it, it has to be on the same
+        // filesystem so the rename is atomic. Falls back to remove() if the entry cannot be renamed. Errors of the
+        // background removal are not reported.
+        inline void removeDeferred(const Path& p, const Path& trashParent = "") {
+            const std::string entry = p.removeEmptySuffix().string();
+            if (entry.empty() || !exists(entry)) return;
+            std::string trash = trashParent.string();
+            if (trash.empty()) {
+                size_t slash = entry.find_last_of('/');
+                if (slash != std::string::npos) trash = entry.substr(0, slash + 1);
+            } else if (trash.back() != '/') {
+                trash += '/';
+            }
+            trash += ".estd_trash";
+            std::error_code ec;
+            for (int attempt = 0; attempt < 8; attempt++) {
+                std::filesystem::create_directory(trash, ec); // again if the worker removed it meanwhile
+                if (ec) break;
+                std::string target = trash + "/" + estd::string_util::gen_random(12);
+                if (exists(target)) continue;
+                if (std::rename(entry.c_str(), target.c_str()) == 0) {
+                    if (!detail::DeferredRemover::instance().push(target)) remove(target);
+                    return;
+                }
+                if (errno != EEXIST && errno != ENOTEMPTY && errno != ENOENT) break; // EXDEV, permissions, ...
+            }
+            std::filesystem::remove(trash, ec); // only if empty
+            remove(entry);
+        }
+
+        // blocks until every removeDeferred() call so far has finished
+        inline void waitForDeferredRemovals() { detail::DeferredRemover::instance().flush(); }
+
+        // Streaming 64 bit content hash (not cryptographic). Four independent lanes over 32 byte blocks so the
+        // compiler can keep them in vector registers, finished with a splitmix avalanche.
+        class ContentHash {
+        private:
+            uint64_t lanes[4] = {
+                0x9E3779B97F4A7C15ull,
+                0xC2B2AE3D27D4EB4Full,
+                0x165667B19E3779F9ull,
+                0x27D4EB2F165667C5ull,
+            };
+            unsigned char tail[32];
+            size_t tailSize = 0;
+            uint64_t length = 0;
+
+            static uint64_t rotl(uint64_t x, int r) noexcept { return (x << r) | (x >> (64 - r)); }
+            static uint64_t avalanche(uint64_t x) noexcept {
+                x ^= x >> 30;
+                x *= 0xBF58476D1CE4E5B9ull;
+                x ^= x >> 27;
+                x *= 0x94D049BB133111EBull;
+                return x ^ (x >> 31);
+            }
+            void block(const unsigned char* p) noexcept {
+                for (int i = 0; i < 4; i++) {
+                    uint64_t word;
+                    std::memcpy(&word, p + 8 * i, 8);
+                    lanes[i] = rotl(lanes[i] ^ (word * 0x9E3779B97F4A7C15ull), 31) * 0xC2B2AE3D27D4EB4Full;
+                }
+            }
+
+        public:
+            void update(const void* data, size_t size) noexcept {
+                auto p = static_cast<const unsigned char*>(data);
+                length += size;
+                if (tailSize > 0) {
+                    size_t take = std::min(size, sizeof(tail) - tailSize);
+                    std::memcpy(tail + tailSize, p, take);
+                    tailSize += take;
+                    p += take;
+                    size -= take;
+                    if (tailSize < sizeof(tail)) return;
+                    block(tail);
+                    tailSize = 0;
+                }
+                for (; size >= sizeof(tail); p += sizeof(tail), size -= sizeof(tail)) block(p);
+                std::memcpy(tail, p, size);
+                tailSize = size;
+            }
+
+            // never 0, so 0 can mean "not hashed"
+            uint64_t digest() const noexcept {
+                uint64_t h = avalanche(length);
+                for (int i = 0; i < 4; i++) h = avalanche(h ^ lanes[i]);
+                for (size_t i = 0; i < tailSize; i++) h = rotl(h ^ tail[i], 8) * 0x100000001B3ull;
+                h = avalanche(h);
+                return h == 0 ? 1 : h;
+            }
+        };
+
+        inline uint64_t hashFile(const Path& p) {
+            std::unique_ptr<std::FILE, int (*)(std::FILE*)> file(std::fopen(p.string().c_str(), "rb"), &std::fclose);
+            if (!file) throwError(std::string("hashFile cannot open: ") + std::strerror(errno), &p);
+            ContentHash hash;
+            std::vector<char> buffer(1 << 16);
+            size_t n;
+            while ((n = std::fread(buffer.data(), 1, buffer.size(), file.get())) > 0) hash.update(buffer.data(), n);
+            if (std::ferror(file.get())) throwError("hashFile read failed", &p);
+            return hash.digest();
+        }
+
+        struct ManifestEntry {
+            FileType type = FileType::none;
+            uint64_t inode = 0;
+            uint64_t size = 0;
+            int64_t mtime = 0; // nanoseconds
+            uint64_t hash = 0; // 0 if the content was not hashed
+
+            bool sameMetadata(const ManifestEntry& other) const noexcept {
+                return type == other.type && inode == other.inode && size == other.size && mtime == other.mtime;
+            }
+        };
+
+        // What an incremental copy saw in the source tree the last time it ran, keyed by path relative to the
+        // copied root (directories end with a slash). Stored as one tab separated line per entry.
+        class CopyManifest {
+        private:
+            std::map<std::string, ManifestEntry> entries;
+
+            static std::string escape(const std::string& s) {
+                std::string result;
+                for (char c : s) {
+                    if (c == '\\') result += "\\\\";
+                    else if (c == '\n') result += "\\n";
+                    else result += c;
                 }
-            } else if (opt & CopyOptions::overwriteExisting) {
-                auto newTime = getModificationTime(from);
-                if (exists(to) && !isDirectory(to)) remove(to);
-                createDirectories(to); // copy_dir does not work
-                setModificationTime(to, newTime);
-            } else if (opt & CopyOptions::skipExisting) {
-                if (!exists(to)) createDirectories(to); // copy_dir does not work
-            } else {
-                if (!exists(to)) {
-                    createDirectories(to); // copy_dir does not work
-                } else {
-                    throwError("copyDirectory cannot copy, entry exists", &to);
+                return result;
+            }
+            static std::string unescape(const std::string& s) {
+                std::string result;
+                for (size_t i = 0; i < s.size(); i++) {
+                    if (s[i] == '\\' && i + 1 < s.size()) {
+                        result += s[++i] == 'n' ? '\n' : s[i];
+                    } else {
+                        result += s[i];
+                    }
                 }
+                return result;
             }
 
-            if (!isDirectory(to)) return; // do not copy sub files to a file
+        public:
+            // the manifest of a copy to "some/dir/" lives in "some/dir.manifest"
+            static Path defaultLocation(const Path& to) { return to.removeEmptySuffix() + ".manifest"; }
 
-            // dir has been copied
+            // a missing or unreadable manifest loads as empty, which makes the next copy a full one
+            void load(const Path& file) {
+                entries.clear();
+                std::unique_ptr<std::FILE, int (*)(std::FILE*)> in(
+                    std::fopen(file.string().c_str(), "rb"), &std::fclose
+                );
+                if (!in) return;
+                std::string line;
+                int c;
+                while (true) {
+                    line.clear();
+                    while ((c = std::fgetc(in.get())) != EOF && c != '\n') line += char(c);
+                    if (line.empty() && c == EOF) break;
+                    size_t fields[5];
+                    size_t pos = 0;
+                    for (size_t& field : fields) {
+                        field = pos;
+                        pos = line.find('\t', pos);
+                        if (pos == std::string::npos) break;
+                        pos++;
+                    }
+                    if (pos == std::string::npos) {
+                        entries.clear(); // corrupt, start over
+                        return;
+                    }
+                    ManifestEntry e;
+                    e.type = FileType(std::strtoul(line.c_str() + fields[0], nullptr, 10));
+                    e.inode = std::strtoull(line.c_str() + fields[1], nullptr, 10);
+                    e.size = std::strtoull(line.c_str() + fields[2], nullptr, 10);
+                    e.mtime = std::strtoll(line.c_str() + fields[3], nullptr, 10);
+                    e.hash = std::strtoull(line.c_str() + fields[4], nullptr, 16);
+                    entries[unescape(line.substr(pos))] = e;
+                    if (c == EOF) break;
+                }
+            }
 
-            if (!(opt & CopyOptions::recursive)) return;
+            // written to a temporary file and renamed over the old manifest
+            void save(const Path& file) const {
+                Path tmp = file + ".tmp";
+                std::unique_ptr<std::FILE, int (*)(std::FILE*)> out(
+                    std::fopen(tmp.string().c_str(), "wb"), &std::fclose
+                );
+                if (!out) throwError(std::string("cannot write manifest: ") + std::strerror(errno), &tmp);
+                for (const auto& [path, e] : entries) {
+                    std::fprintf(
+                        out.get(),
+                        "%u\t%llu\t%llu\t%lld\t%llx\t%s\n",
+                        unsigned(e.type),
+                        (unsigned long long)e.inode,
+                        (unsigned long long)e.size,
+                        (long long)e.mtime,
+                        (unsigned long long)e.hash,
+                        escape(path).c_str()
+                    );
+                }
+                if (std::fflush(out.get()) != 0) throwError("cannot write manifest", &tmp);
+                out.reset();
+                if (std::rename(tmp.string().c_str(), file.string().c_str()) != 0) {
+                    throwError("cannot replace manifest", &file);
+                }
+            }
 
-            estd::stack_ptr<std::runtime_error> err; // do not abort on a single error
-            for (auto e : DirectoryIterator(from)) {
-                try {
-                    Path fromE = e.path();
-                    Path toE = fromE.replacePrefix(from, to).value();
+            const ManifestEntry* find(const std::string& relative) const {
+                auto it = entries.find(relative);
+                return it == entries.end() ? nullptr : &it->second;
+            }
+            void set(const std::string& relative, const ManifestEntry& e) { entries[relative] = e; }
+            size_t size() const noexcept { return entries.size(); }
 
-                    copy(fromE, toE, opt);
-                } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
+            // names of the direct children recorded under a directory ("a/" -> "a/x", "a/y/")
+            std::vector<std::string> children(const std::string& directory) const {
+                std::vector<std::string> result;
+                for (auto it = entries.upper_bound(directory); it != entries.end(); ++it) {
+                    const std::string& key = it->first;
+                    if (key.compare(0, directory.size(), directory) != 0) break;
+                    size_t slash = key.find('/', directory.size());
+                    if (slash == std::string::npos || slash == key.size() - 1) result.push_back(key);
+                }
+                return result;
             }
+        };
+
+        namespace {
+            // lstat of a single entry, false if it does not exist
+            inline bool manifestStat(const Path& p, ManifestEntry& e) {
+                FileStatus st(p.removeEmptySuffix());
+                if (!st.exists()) return false;
+                e.type = st.type();
+                e.inode = st.inode();
+                e.size = e.type == FileType::regular ? st.size() : 0;
+                e.mtime = st.modificationTime();
+                return true;
+            }
+        } // namespace
+
+        enum ManifestOptions : uint64_t {
+            manifestDefault = 0,
+            manifestHashContents = 1 << 0 // record content hashes, a touched but identical file is not copied again
+        };
+
+        // Incremental copy(from, to, opt) for repeated mirrors. The source tree as copied is recorded in a manifest
+        // (CopyManifest::defaultLocation(to) unless given). On the next run a directory whose mtime and inode did
+        // not change is not listed again, its recorded children are used, and every file is compared against its
+        // recorded inode, size and mtime with a single lstat of the source. Unchanged entries are skipped without
+        // looking at the destination at all, so the destination must not be modified behind the manifest's back
+        // (delete the manifest to force a full pass). Changed files are overwritten, new ones follow `opt`.
+        inline void copyIncremental(
+            const Path& from,
+            const Path& to,
+            const uint64_t opt = CopyOptions::recursive | CopyOptions::updateExisting,
+            const uint64_t manifestOpt = ManifestOptions::manifestDefault,
+            Path manifestFile = ""
+        ) {
+            if (manifestFile.string().empty()) manifestFile = CopyManifest::defaultLocation(to);
+            if (!from.isDirectory() || isSoftLink(from.removeEmptySuffix())) {
+                copy(from, to, opt);
+                return;
+            }
+            const uint64_t childOpt = opt & ~uint64_t(CopyOptions::parallel | CopyOptions::ioUring);
+            const uint64_t changedOpt =
+                (childOpt & ~uint64_t(CopyOptions::skipExisting | CopyOptions::updateExisting)) |
+                CopyOptions::overwriteExisting;
+            const bool hashing = manifestOpt & ManifestOptions::manifestHashContents;
+
+            CopyManifest previous, current;
+            previous.load(manifestFile);
+            estd::stack_ptr<std::runtime_error> err; // do not abort on a single error
+
+            std::function<void(const Path&, const Path&, const std::string&)> visit;
+            visit = [&](const Path& fromDir, const Path& toDir, const std::string& rel) {
+                ManifestEntry dir;
+                if (!manifestStat(fromDir, dir)) throwError("copyIncremental directory vanished", &fromDir);
+                const ManifestEntry* old = previous.find(rel);
+                bool sameListing = old != nullptr && old->sameMetadata(dir);
+                if (!sameListing && !copyDirectoryNode(fromDir, toDir, childOpt)) return;
+                current.set(rel, dir);
+
+                std::vector<std::string> names;
+                if (sameListing) {
+                    for (auto& child : previous.children(rel)) names.push_back(child.substr(rel.size()));
+                } else {
+                    for (const auto& e : FastDirectoryIterator(fromDir)) {
+                        names.push_back(std::string(e.path().view().substr(fromDir.view().size())));
+                    }
+                }
+
+                for (const auto& name : names) {
+                    try {
+                        Path fromE = fromDir + name;
+                        Path toE = toDir + name;
+                        ManifestEntry now;
+                        if (!manifestStat(fromE, now)) continue; // removed since the manifest was written
+                        if (now.type == FileType::directory) {
+                            std::string sub = rel + name;
+                            if (sub.back() != '/') sub += '/';
+                            visit(fromE.addEmptySuffix(), toE.addEmptySuffix(), sub);
+                            continue;
+                        }
+                        std::string key = rel + name;
+                        if (!key.empty() && key.back() == '/') key.pop_back();
+                        const ManifestEntry* before = previous.find(key);
+                        if (before != nullptr && before->sameMetadata(now)) {
+                            current.set(key, *before);
+                            continue;
+                        }
+                        if (hashing && now.type == FileType::regular) {
+                            now.hash = hashFile(fromE);
+                            if (before != nullptr && before->type == now.type && before->size == now.size &&
+                                before->hash == now.hash) {
+                                current.set(key, now); // touched, same content
+                                continue;
+                            }
+                        }
+                        const uint64_t entryOpt = before != nullptr ? changedOpt : childOpt;
+                        if (now.type == FileType::softLink) { // also links to directories, they are not entered
+                            copySoftLink(fromE.removeEmptySuffix(), toE.removeEmptySuffix(), entryOpt);
+                        } else {
+                            copy(fromE, toE, entryOpt);
+                        }
+                        current.set(key, now);
+                    } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
+                }
+            };
+
+            try {
+                visit(from.addEmptySuffix(), to.addEmptySuffix(), "");
+            } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
+            current.save(manifestFile);
             if (err) throw err.value();
         }
-        inline void copyFile(Path from, Path to, const uint64_t opt = CopyOptions::none) {
-            if (from.isFile() && to.isDirectory()) {
-                copyFile(from, to / from.getSuffix(), opt);
+
+        namespace {
+            inline bool sameContent(const Path& a, const Path& b) {
+                using File = std::unique_ptr<std::FILE, int (*)(std::FILE*)>;
+                File fa(std::fopen(a.string().c_str(), "rb"), &std::fclose);
+                File fb(std::fopen(b.string().c_str(), "rb"), &std::fclose);
+                if (!fa || !fb) return false;
+                std::vector<char> ba(1 << 16), bb(1 << 16);
+                while (true) {
+                    size_t na = std::fread(ba.data(), 1, ba.size(), fa.get());
+                    size_t nb = std::fread(bb.data(), 1, bb.size(), fb.get());
+                    if (na != nb || std::memcmp(ba.data(), bb.data(), na) != 0) return false;
+                    if (na == 0) return !std::ferror(fa.get()) && !std::ferror(fb.get());
+                }
+            }
+        } // namespace
+
+        // Copies like copy(from, to, opt) but regular files with identical content and permissions are written once,
+        // later duplicates become hard links to the first copy in the destination (copy on write clones with
+        // CopyOptions::reflinkPreferred or reflinkOnly). Files are bucketed by size first, only sizes that occur
+        // more than once are hashed, and equal hashes are confirmed byte by byte before linking. Duplicates whose
+        // destination already exists go through copyFile and keep the usual skip/overwrite/update behaviour.
+        inline void copyDeduplicated(const Path& from, const Path& to, const uint64_t opt) {
+            const uint64_t plainOpt = opt & ~uint64_t(CopyOptions::dedupe);
+            if (!from.isDirectory() || isSoftLink(from.removeEmptySuffix()) || (opt & CopyOptions::directoriesOnly)) {
+                copy(from, to, plainOpt & ~uint64_t(CopyOptions::parallel | CopyOptions::ioUring));
                 return;
             }
-            if (from.isDirectory()) throwError("copyFile cannot copy a directory", &from);
-            // At this point we can assume that from is a file and to is also a file (in terms of paths)
+            const uint64_t childOpt = plainOpt & ~uint64_t(CopyOptions::parallel | CopyOptions::ioUring);
+            const uint64_t fileOpt = childOpt & ~uint64_t(CopyOptions::reflinkPreferred | CopyOptions::reflinkOnly);
+            estd::stack_ptr<std::runtime_error> err; // do not abort on a single error
 
-            using sco = std::filesystem::copy_options;
-            sco sopt = sco::none;
+            struct File {
+                Path from, to;
+                FileStatus status; // from the directory listing, no further stat per file
+            };
+            std::map<uint64_t, std::vector<File>> bySize;
+            std::function<void(const Path&, const Path&)> plan;
+            plan = [&](const Path& from, const Path& to) {
+                const PrefixRewriter rewriter(from, to);
+                for (const auto& e : FastDirectoryIterator(from)) {
+                    try {
+                        Path toE = rewriter.rewrite(e.path()).value();
+                        if (e.type() == FileType::regular) {
+                            const FileStatus& status = e.fileStatus();
+                            bySize[status.size()].push_back({e.path(), toE, status});
+                        } else if (e.isDirectory() && !e.isSoftLink()) {
+                            if (copyDirectoryNode(e.path(), toE, childOpt)) plan(e.path(), toE);
+                        } else {
+                            copy(e.path(), toE, childOpt);
+                        }
+                    } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
+                }
+            };
+            Path root = to.addEmptySuffix();
+            if (!copyDirectoryNode(from, root, childOpt)) return; // errors on the root are thrown directly
+            try {
+                plan(from, root);
+            } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
 
-            if (opt & CopyOptions::overwriteExisting) {
-                sopt |= sco::overwrite_existing;
-            } else if (opt & CopyOptions::updateExisting) {
-                sopt |= sco::update_existing;
-            } else if (opt & CopyOptions::skipExisting) {
-                sopt |= sco::skip_existing;
+            auto link = [&](const File& original, const File& duplicate) {
+                if (opt & (CopyOptions::reflinkPreferred | CopyOptions::reflinkOnly)) {
+                    try {
+                        copyFile(original.to, duplicate.to, fileOpt | CopyOptions::reflinkOnly);
+                        return;
+                    } catch (FileException&) {
+                        if (opt & CopyOptions::reflinkOnly) throw;
+                    }
+                }
+                createHardLink(original.to, duplicate.to);
+            };
+
+            for (auto& [size, files] : bySize) {
+                std::map<std::pair<uint64_t, Permissions>, std::vector<const File*>> groups; // (hash, perms)
+                for (const File& f : files) {
+                    try {
+                        if (files.size() == 1 || size == 0) {
+                            copyFile(f.from, f.status, f.to, childOpt);
+                        } else {
+                            groups[{hashFile(f.from), f.status.permissions()}].push_back(&f);
+                        }
+                    } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
+                }
+                for (auto& group : groups) {
+                    std::vector<const File*> originals; // copies written by this run, safe to link to
+                    for (const File* f : group.second) {
+                        try {
+                            bool fresh = !exists(f->to);
+                            const File* original = nullptr;
+                            for (const File* o : originals) {
+                                if (fresh && sameContent(o->from, f->from)) {
+                                    original = o;
+                                    break;
+                                }
+                            }
+                            if (original != nullptr) {
+                                link(*original, *f);
+                                continue;
+                            }
+                            copyFile(f->from, f->status, f->to, childOpt);
+                            if (fresh) originals.push_back(f);
+                        } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
+                    }
+                }
             }
+            if (err) throw err.value();
+        }
 
-            if (opt & CopyOptions::directoriesOnly) { return; }
-            if (!(opt & CopyOptions::softLinksAsCopies)) { sopt |= sco::copy_symlinks; }
-            if (opt & CopyOptions::copyAsHardLinks) {
-                sopt |= sco::create_hard_links;
-            } else if (opt & CopyOptions::copyAsSoftLinks) {
-                sopt |= sco::create_symlinks;
+        enum class DiffMode {
+            sizeAndTime, // a file is modified if the sizes differ or the source is newer (like updateExisting)
+            content      // a file is modified if the sizes or the bytes differ
+        };
+
+        // the differences between two trees, see treeDiff()
+        struct TreeDiff {
+            enum class Change : uint8_t { added, removed, modified, typeChanged };
+            struct Entry {
+                Path path;     // relative to both roots, directories with a trailing slash
+                Change change;
+                FileType type; // in the source tree, in the destination tree for removed entries
+            };
+            std::vector<Entry> entries; // sorted by path, an added or removed directory stands for its contents
+
+            bool empty() const noexcept { return entries.empty(); }
+            size_t size() const noexcept { return entries.size(); }
+        };
+
+        // Compares the tree `to` against `from` walking both at once: every pair of directories is listed, sorted
+        // by name and merge joined, pairs of subdirectories are compared concurrently on a work stealing pool of
+        // `threads` workers (0 = hardware concurrency). Soft links are compared by target and never entered. A
+        // missing root counts as empty. Errors do not stop the walk, the last one is rethrown at the end.
+        inline TreeDiff treeDiff(
+            const Path& from, const Path& to, DiffMode mode = DiffMode::sizeAndTime, size_t threads = 0
+        ) {
+            const Path fromRoot = from.addEmptySuffix(), toRoot = to.addEmptySuffix();
+            std::mutex m;
+            estd::stack_ptr<std::runtime_error> err;
+            TreeDiff diff;
+            auto setError = [&](const std::exception& e) {
+                std::lock_guard<std::mutex> lk(m);
+                err = std::runtime_error(e.what());
+            };
+
+            struct Listed {
+                std::string_view name;
+                FastDirectoryEntry entry;
+            };
+            auto list = [](const Path& dir, std::vector<Listed>& out) {
+                if (!exists(dir)) return;
+                const size_t prefix = dir.view().size();
+                for (const auto& e : FastDirectoryIterator(dir)) out.push_back({std::string_view(), e});
+                for (auto& l : out) { // the entries do not move any more
+                    l.name = l.entry.path().view().substr(prefix);
+                    if (!l.name.empty() && l.name.back() == '/') l.name.remove_suffix(1);
+                }
+                std::sort(out.begin(), out.end(), [](const Listed& lhs, const Listed& rhs) {
+                    return lhs.name < rhs.name;
+                });
+            };
+            auto modified = [&](const FastDirectoryEntry& a, const FastDirectoryEntry& b) {
+                if (a.type() == FileType::softLink) { // links to directories carry a slash, read the link itself
+                    return followSoftLink(a.path().removeEmptySuffix()) != followSoftLink(b.path().removeEmptySuffix());
+                }
+                if (a.type() != FileType::regular) return false;
+                const FileStatus& sa = a.fileStatus();
+                const FileStatus& sb = b.fileStatus();
+                if (sa.size() != sb.size()) return true;
+                if (mode == DiffMode::content) return !sameContent(a.path(), b.path());
+                return sa.modificationTime() > sb.modificationTime();
+            };
+
+            WorkStealingPool pool(threads);
+            std::function<void(std::string)> compare;
+            compare = [&](std::string relative) {
+                std::vector<TreeDiff::Entry> changes;
+                try {
+                    std::vector<Listed> a, b;
+                    list(fromRoot + relative, a);
+                    list(toRoot + relative, b);
+                    auto add = [&](const Listed& l, TreeDiff::Change change) {
+                        const bool directory = l.entry.isDirectory() && !l.entry.isSoftLink();
+                        std::string path = relative + std::string(l.name) + (directory ? "/" : "");
+                        changes.push_back({Path(std::move(path)), change, l.entry.type()});
+                    };
+                    size_t i = 0, j = 0;
+                    while (i < a.size() || j < b.size()) {
+                        if (j == b.size() || (i < a.size() && a[i].name < b[j].name)) {
+                            add(a[i++], TreeDiff::Change::added);
+                        } else if (i == a.size() || b[j].name < a[i].name) {
+                            add(b[j++], TreeDiff::Change::removed);
+                        } else {
+                            const Listed &l = a[i++], &r = b[j++];
+                            try {
+                                if (l.entry.type() != r.entry.type()) {
+                                    add(l, TreeDiff::Change::typeChanged);
+                                } else if (l.entry.type() == FileType::directory) {
+                                    std::string sub = relative + std::string(l.name) + "/";
+                                    pool.submit([&compare, sub] { compare(sub); });
+                                } else if (modified(l.entry, r.entry)) {
+                                    add(l, TreeDiff::Change::modified);
+                                }
+                            } catch (std::exception& tmp) { setError(tmp); }
+                        }
+                    }
+                } catch (std::exception& tmp) { setError(tmp); }
+                std::lock_guard<std::mutex> lk(m);
+                for (auto& c : changes) diff.entries.push_back(std::move(c));
+            };
+            pool.submit([&] { compare(""); });
+            pool.wait();
+            if (err) throw err.value();
+            std::sort(diff.entries.begin(), diff.entries.end(), [](const auto& lhs, const auto& rhs) {
+                return lhs.path < rhs.path;
+            });
+            return diff;
+        }
+
+        // Brings `to` in line with `from` using a treeDiff(from, to): added, modified and type changed entries are
+        // copied with opt (existing entries are overwritten), removed entries are removed, the rest is not touched.
+        inline void copy(
+            const Path& from, const Path& to, const TreeDiff& diff, const uint64_t opt = CopyOptions::none
+        ) {
+            const uint64_t copyOpt = (opt | CopyOptions::recursive | CopyOptions::overwriteExisting) &
+                                     ~uint64_t(CopyOptions::skipExisting | CopyOptions::updateExisting);
+            const Path fromRoot = from.addEmptySuffix(), toRoot = to.addEmptySuffix();
+            if (!diff.empty()) createDirectories(toRoot);
+            estd::stack_ptr<std::runtime_error> err; // do not abort on a single error
+            for (const auto& e : diff.entries) {
+                try {
+                    const Path target = toRoot + e.path;
+                    switch (e.change) {
+                        case TreeDiff::Change::removed: remove(target.removeEmptySuffix()); break;
+                        case TreeDiff::Change::typeChanged: remove(target.removeEmptySuffix()); [[fallthrough]];
+                        case TreeDiff::Change::added:
+                        case TreeDiff::Change::modified: copy(fromRoot + e.path, target, copyOpt); break;
+                    }
+                } catch (std::exception& tmp) { err = std::runtime_error(tmp.what()); }
             }
+            if (err) throw err.value();
+        }
 
-            if (isDirectory(from)) throwError("copyFile cannot copy expected a file got a directory", &from);
-            if (isDirectory(to)) {
-                if (opt & CopyOptions::skipExisting) {
-                    return;
-                } else if (opt & CopyOptions::overwriteExisting) {
-                    remove(to);
-                    std::filesystem::copy_file(from, to, sopt);
-                    return;
-                } else if (opt & CopyOptions::updateExisting) {
-                    if (getModificationTime(from) < getModificationTime(to)) return;
-                    remove(to);
-                    std::filesystem::copy_file(from, to, sopt);
-                    return;
-                } else {
-                    throwError("copyFile cannot copy a file to replace a directory", &from);
+        // sample error:
+        // filesystem error: cannot copy: No such file or directory [...] [...]
+
+
+#ifdef __linux__
+        enum class MapMode {
+            readOnly,   // PROT_READ, MAP_SHARED
+            readWrite,  // writes go to the file, the file is created if missing and can be resized
+            copyOnWrite // writable private copy of the pages, the file is never modified
+        };
+
+        enum class MapAdvice { normal, sequential, random, willNeed, dontNeed, hugePage };
+
+        // Memory mapped view of a whole file. Reads are page cache hits without a copy into a buffer, an empty file
+        // maps to data() == nullptr and size() == 0.
+        class MappedFile {
+        private:
+            FileDescriptor iFd;
+            char* iData = nullptr;
+            size_t iSize = 0;
+            MapMode iMode = MapMode::readOnly;
+            bool iPopulate = false;
+            Path iPath; // for errors
+
+            void map(size_t size) {
+                iSize = size;
+                if (size == 0) return;
+                int prot = iMode == MapMode::readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+                int flags = (iMode == MapMode::readWrite ? MAP_SHARED : MAP_PRIVATE) | (iPopulate ? MAP_POPULATE : 0);
+                void* p = ::mmap(nullptr, size, prot, flags, iFd, 0);
+                if (p == MAP_FAILED) {
+                    iSize = 0;
+                    throwError(std::string("MappedFile cannot map: ") + std::strerror(errno), &iPath);
                 }
+                iData = static_cast<char*>(p);
+            }
+            void unmap() noexcept {
+                if (iData != nullptr) ::munmap(iData, iSize);
+                iData = nullptr;
+                iSize = 0;
             }
 
-            if (CopyOptions::overwriteReadonly) remove(to);
-            std::filesystem::copy_file(from, to, sopt);
-        }
+        public:
+            MappedFile() noexcept {}
+            explicit MappedFile(const Path& p, MapMode mode = MapMode::readOnly, bool populate = false) :
+                iMode(mode), iPopulate(populate), iPath(p) {
+                int flags = mode == MapMode::readWrite ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC;
+                iFd.reset(::open(p.string().c_str(), flags, 0666));
+                if (!iFd) throwError(std::string("MappedFile cannot open: ") + std::strerror(errno), &p);
+                struct stat st;
+                if (::fstat(iFd, &st) != 0) {
+                    throwError(std::string("MappedFile cannot stat: ") + std::strerror(errno), &p);
+                }
+                map(size_t(st.st_size));
+            }
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+            MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+            MappedFile& operator=(MappedFile&& other) noexcept {
+                if (this != &other) {
+                    unmap();
+                    iFd = std::move(other.iFd);
+                    iData = std::exchange(other.iData, nullptr);
+                    iSize = std::exchange(other.iSize, 0);
+                    iMode = other.iMode;
+                    iPopulate = other.iPopulate;
+                    iPath = std::move(other.iPath);
+                }
+                return *this;
+            }
+            ~MappedFile() { unmap(); }
 
-        inline void rename(Path from, Path to) {
-            if (from.isDirectory() != isDirectory(from)) {
-                if (from.isDirectory()) {
-                    throwError("cannot rename: source not a directory", &from);
-                } else {
-                    throwError("cannot rename: source not a file", &from);
+            // writable unless the mode is readOnly
+            char* data() noexcept { return iData; }
+            const char* data() const noexcept { return iData; }
+            size_t size() const noexcept { return iSize; }
+            bool empty() const noexcept { return iSize == 0; }
+            std::string_view view() const noexcept { return std::string_view(iData, iSize); }
+            MapMode mode() const noexcept { return iMode; }
+            explicit operator bool() const noexcept { return bool(iFd); }
+
+            // madvise over [offset, offset + length), the start is rounded down to a page, returns false if the
+            // kernel rejected the hint (hugePage needs transparent huge pages for files)
+            bool advise(MapAdvice advice, size_t offset = 0, size_t length = std::numeric_limits<size_t>::max()) {
+                if (iData == nullptr || offset >= iSize) return true;
+                const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+                const size_t start = offset / page * page;
+                length = std::min(length, iSize - offset) + (offset - start);
+                int flag = MADV_NORMAL;
+                switch (advice) {
+                    case MapAdvice::normal: flag = MADV_NORMAL; break;
+                    case MapAdvice::sequential: flag = MADV_SEQUENTIAL; break;
+                    case MapAdvice::random: flag = MADV_RANDOM; break;
+                    case MapAdvice::willNeed: flag = MADV_WILLNEED; break;
+                    case MapAdvice::dontNeed: flag = MADV_DONTNEED; break;
+                    case MapAdvice::hugePage:
+#ifdef MADV_HUGEPAGE
+                        flag = MADV_HUGEPAGE;
+                        break;
+#else
+                        return false;
+#endif
                 }
+                return ::madvise(iData + start, length, flag) == 0;
             }
-            if (from.isDirectory() != to.isDirectory()) {
-                if (from.isDirectory()) {
-                    throwError("cannot rename: destination not a directory", &from);
-                } else {
-                    throwError("cannot rename: destination not a file", &from);
+
+            // readWrite only: changes the file size with ftruncate and remaps, data() may move
+            void resize(size_t newSize) {
+                if (iMode != MapMode::readWrite) throwError("MappedFile can only resize a readWrite mapping", &iPath);
+                if (::ftruncate(iFd, off_t(newSize)) != 0) {
+                    throwError(std::string("MappedFile cannot resize: ") + std::strerror(errno), &iPath);
+                }
+                if (iData != nullptr && newSize != 0) {
+                    void* p = ::mremap(iData, iSize, newSize, MREMAP_MAYMOVE);
+                    if (p == MAP_FAILED) {
+                        throwError(std::string("MappedFile cannot remap: ") + std::strerror(errno), &iPath);
+                    }
+                    iData = static_cast<char*>(p);
+                    iSize = newSize;
+                    return;
                 }
+                unmap();
+                map(newSize);
             }
-            if (std::rename(from.string().c_str(), to.string().c_str()) != 0) {
-                throwError("Failed to rename: source file ", &from);
+
+            // readWrite only: writes the dirty pages back (msync), waits for them unless async
+            void sync(bool async = false) {
+                if (iData == nullptr || iMode != MapMode::readWrite) return;
+                if (::msync(iData, iSize, async ? MS_ASYNC : MS_SYNC) != 0) {
+                    throwError(std::string("MappedFile cannot sync: ") + std::strerror(errno), &iPath);
+                }
             }
-        }
+        };
+#endif
 
-        inline void copy(Path from, Path to, const uint64_t opt) {
-            if (!exists(from.removeEmptySuffix())) throwError("cannot copy: No such file or directory", &from);
+#ifdef __linux__
+        // one batch of Watcher::poll, every changed entry once and sorted, directories with a trailing slash
+        struct ChangeSet {
+            std::vector<Path> paths; // created, modified, moved (both names) or removed entries
+            bool rescan = false; // the kernel queue overflowed, anything below the root may have changed
 
-            if (from.isDirectory() != isDirectory(from)) {
-                if (from.isDirectory()) {
-                    throwError("cannot copy: source not a directory", &from);
-                } else {
-                    throwError("cannot copy: source not a file", &from);
+            bool empty() const noexcept { return paths.empty() && !rescan; }
+        };
+
+        // Recursive inotify watch of a tree. New directories are watched as they appear (and reported with their
+        // contents, which may predate the watch), moved away or removed ones are dropped. Events of a burst are
+        // coalesced: poll() keeps collecting for `window` after the first one and returns them as one ChangeSet.
+        // On IN_Q_OVERFLOW the watches are rebuilt and the set is flagged for a rescan. Soft links are reported
+        // but never followed.
+        class Watcher {
+        private:
+            static constexpr uint32_t mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                             IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR |
+                                             IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+            FileDescriptor iFd;
+            Path iRoot; // with a trailing slash
+            std::chrono::milliseconds iWindow;
+            std::map<int, Path> iWatches; // descriptor to directory
+            std::vector<char> iBuffer;
+
+            // watches dir and every directory below it, reports the entries into `changes` if given
+            void watchTree(const Path& dir, std::set<Path>* changes) {
+                int wd = ::inotify_add_watch(iFd, dir.string().c_str(), mask);
+                if (wd < 0) {
+                    if (errno == ENOENT || errno == ENOTDIR) return; // gone again
+                    throwError(std::string("Watcher cannot watch: ") + std::strerror(errno), &dir);
                 }
+                iWatches[wd] = dir;
+                try {
+                    for (const auto& e : FastDirectoryIterator(dir)) {
+                        if (changes != nullptr) changes->insert(e.path());
+                        if (e.isDirectory() && !e.isSoftLink()) watchTree(e.path(), changes);
+                    }
+                } catch (FileException&) {} // removed while listing, its events follow
             }
 
-            try {
-                if (isSoftLink(from.removeEmptySuffix())) {
-                    // std::cout << "copy_symlink(" << from << ", " << to << ")\n";
-                    copySoftLink(from.removeEmptySuffix(), to.removeEmptySuffix(), opt);
-                } else if (from.isFile()) { // TODO: test strange files such as sockets and blocks under this if
-                    // std::cout << "copy_file(" << from << ", " << to << ")\n";
-                    copyFile(from, to, opt);
-                } else if (from.isDirectory()) {
-                    // std::cout << "copy_dir(" << from << ", " << to << ")\n";
-                    copyDirectory(from, to.addEmptySuffix(), opt);
+            void unwatchTree(const Path& dir) {
+                for (auto it = iWatches.begin(); it != iWatches.end();) {
+                    if (it->second.view().substr(0, dir.view().size()) == dir.view()) {
+                        ::inotify_rm_watch(iFd, it->first);
+                        it = iWatches.erase(it);
+                    } else {
+                        it++;
+                    }
                 }
-            } catch (std::exception& e) { throw std::runtime_error(e.what()); }
-        }
+            }
 
-        // sample error:
-        // filesystem error: cannot copy: No such file or directory [...] [...]
+            // reads what is queued, false if nothing was
+            bool drain(std::set<Path>& changes, bool& rescan) {
+                ssize_t n = ::read(iFd, iBuffer.data(), iBuffer.size());
+                if (n <= 0) {
+                    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                        throwError(std::string("Watcher cannot read: ") + std::strerror(errno), &iRoot);
+                    }
+                    return false;
+                }
+                for (ssize_t pos = 0; pos < n;) {
+                    const auto* e = reinterpret_cast<const struct inotify_event*>(iBuffer.data() + pos);
+                    pos += sizeof(struct inotify_event) + e->len;
+                    if (e->mask & IN_Q_OVERFLOW) {
+                        rescan = true;
+                        continue;
+                    }
+                    auto it = iWatches.find(e->wd);
+                    if (it == iWatches.end()) continue;
+                    if (e->mask & IN_IGNORED) {
+                        iWatches.erase(it);
+                        continue;
+                    }
+                    if (e->len == 0) { // about the watched directory itself
+                        if (e->mask & IN_DELETE_SELF) changes.insert(it->second);
+                        continue;
+                    }
+                    const bool directory = e->mask & IN_ISDIR;
+                    Path p = it->second + e->name;
+                    if (directory) p += "/";
+                    changes.insert(p);
+                    if (directory && (e->mask & (IN_CREATE | IN_MOVED_TO))) watchTree(p, &changes);
+                    if (directory && (e->mask & IN_MOVED_FROM)) unwatchTree(p);
+                }
+                return true;
+            }
+
+        public:
+            explicit Watcher(const Path& root, std::chrono::milliseconds window = std::chrono::milliseconds(50)) :
+                iRoot(root.addEmptySuffix()), iWindow(window), iBuffer(1 << 16) {
+                iFd.reset(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+                if (!iFd) throwError(std::string("Watcher cannot start: ") + std::strerror(errno), &root);
+                if (!isDirectory(iRoot)) throwError("Watcher root is not a directory", &root);
+                watchTree(iRoot, nullptr);
+            }
+
+            const Path& root() const noexcept { return iRoot; }
+            size_t watchCount() const noexcept { return iWatches.size(); }
+            // readable when events are queued, for poll()/epoll based loops
+            int fd() const noexcept { return iFd.get(); }
+
+            // waits up to `timeout` for a change, then collects for the coalescing window, an empty set on timeout
+            ChangeSet poll(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1)) {
+                using clock = std::chrono::steady_clock;
+                std::set<Path> changes;
+                ChangeSet result;
+                struct pollfd pfd = {iFd.get(), POLLIN, 0};
+                int ready = ::poll(&pfd, 1, timeout.count() < 0 ? -1 : int(timeout.count()));
+                if (ready <= 0) return result;
+
+                const auto deadline = clock::now() + iWindow;
+                while (true) {
+                    while (drain(changes, result.rescan)) {}
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now());
+                    if (left.count() <= 0) break;
+                    ::poll(&pfd, 1, int(left.count()));
+                }
+                if (result.rescan) watchTree(iRoot, nullptr); // watches may have been missed, add_watch is idempotent
+                result.paths.assign(changes.begin(), changes.end());
+                return result;
+            }
+        };
+#endif
 
+        namespace {
+            // new empty directory with a unique hidden name below root, created atomically (mkdtemp)
+            inline Path makeTempDirectory(const Path& root) {
+                std::string base = root.string();
+                if (!base.empty() && base.back() != '/') base += '/';
+#ifdef __linux__
+                std::string name = base + ".tmp_XXXXXX";
+                if (::mkdtemp(&name[0]) == nullptr) {
+                    throwError(std::string("cannot create a temporary directory: ") + std::strerror(errno), &root);
+                }
+                return name;
+#else
+                while (true) {
+                    std::string name = base + "." + estd::string_util::gen_random(10);
+                    if (std::filesystem::create_directory(name)) return name; // false if it existed
+                }
+#endif
+            }
+        } // namespace
 
         class TmpDir {
         private:
             std::filesystem::path iPath = "";
             inline static std::string generateUniqueTempDir(std::filesystem::path root) {
-                while (true) {
-                    std::filesystem::path name = "." + estd::string_util::gen_random(10);
-                    name = root / name;
-                    if (!std::filesystem::exists(name)) {
-                        std::filesystem::create_directories(name);
-                        return name.lexically_normal().string();
-                    }
-                }
+                std::filesystem::create_directories(root);
+                return std::filesystem::path(makeTempDirectory(root.string()).string()).lexically_normal().string();
             }
 
         public:
             TmpDir(std::filesystem::path root) { iPath = generateUniqueTempDir(root); }
             TmpDir() { iPath = generateUniqueTempDir(std::filesystem::current_path()); }
-            ~TmpDir() { std::filesystem::remove_all(iPath); }
+            ~TmpDir() {
+                try {
+                    removeDeferred(iPath.string());
+                } catch (std::exception&) {}
+            }
 
             std::filesystem::path path() { return iPath; }
 
+            // the entries are renamed away at once and removed in the background (see removeDeferred)
             void discard() {
-                for (const auto& entry : std::filesystem::directory_iterator(iPath)) std::filesystem::remove_all(entry);
+                Path parent = Path(iPath.string()).removeEmptySuffix().splitSuffix().first; // the trash stays outside
+                if (parent.string().empty()) parent = "./";
+                for (const auto& entry : FastDirectoryIterator(iPath.string())) removeDeferred(entry.path(), parent);
+            }
+        };
+
+        // Hands out scratch directories created ahead of time and takes them back emptied: the leftovers of a lease
+        // are renamed to the trash and removed in the background (see removeDeferred), so a job pays neither for
+        // creating nor for removing its directory. At most `maxIdle` directories are kept, the pool has to outlive
+        // its leases.
+        class TmpDirPool {
+        public:
+            class Lease {
+            private:
+                TmpDirPool* iPool = nullptr;
+                Path iPath;
+
+                friend class TmpDirPool;
+                Lease(TmpDirPool* pool, Path path) : iPool(pool), iPath(std::move(path)) {}
+
+            public:
+                Lease(const Lease&) = delete;
+                Lease(Lease&& other) noexcept : iPool(other.iPool), iPath(std::move(other.iPath)) {
+                    other.iPool = nullptr;
+                }
+                Lease& operator=(const Lease&) = delete;
+                Lease& operator=(Lease&& other) noexcept {
+                    if (this != &other) {
+                        release();
+                        iPool = other.iPool;
+                        iPath = std::move(other.iPath);
+                        other.iPool = nullptr;
+                    }
+                    return *this;
+                }
+                ~Lease() { release(); }
+
+                // the directory, with a trailing slash
+                const Path& path() const noexcept { return iPath; }
+
+                // gives the directory back early, path() must not be used afterwards
+                void release() noexcept {
+                    if (iPool == nullptr) return;
+                    iPool->giveBack(iPath);
+                    iPool = nullptr;
+                }
+            };
+
+        private:
+            Path iRoot;
+            size_t iMaxIdle;
+            mutable std::mutex m;
+            std::vector<Path> iIdle;
+
+            void giveBack(const Path& p) noexcept {
+                try {
+                    Path trashParent = iRoot.string().empty() ? Path("./") : iRoot;
+                    for (const auto& entry : FastDirectoryIterator(p)) removeDeferred(entry.path(), trashParent);
+                    std::lock_guard<std::mutex> lk(m);
+                    if (iIdle.size() < iMaxIdle) {
+                        iIdle.push_back(p);
+                        return;
+                    }
+                } catch (std::exception&) {}
+                try {
+                    removeDeferred(p);
+                } catch (std::exception&) {}
+            }
+
+        public:
+            explicit TmpDirPool(const Path& root = currentPath(), size_t prefill = 0, size_t maxIdle = 64) :
+                iRoot(root), iMaxIdle(std::max(maxIdle, prefill)) {
+                for (size_t i = 0; i < prefill; i++) iIdle.push_back(makeTempDirectory(iRoot) / "");
+            }
+            TmpDirPool(const TmpDirPool&) = delete;
+            TmpDirPool& operator=(const TmpDirPool&) = delete;
+            ~TmpDirPool() {
+                for (const auto& p : iIdle) {
+                    try {
+                        removeDeferred(p);
+                    } catch (std::exception&) {}
+                }
+            }
+
+            // an empty directory, recycled if one is idle
+            Lease acquire() {
+                {
+                    std::lock_guard<std::mutex> lk(m);
+                    if (!iIdle.empty()) {
+                        Path p = std::move(iIdle.back());
+                        iIdle.pop_back();
+                        return Lease(this, std::move(p));
+                    }
+                }
+                return Lease(this, makeTempDirectory(iRoot) / "");
+            }
+
+            size_t idle() const {
+                std::lock_guard<std::mutex> lk(m);
+                return iIdle.size();
             }
         };
 
+
         // template <bool recursive = true, bool overwrite = true>
         // void copy(Path from, Path to) {
         //     if (!std::filesystem::is_directory(from)) {
@@ -0,0 +1,84 @@
+// Built as its own binary (make instrumentation): the switch has to be the same in every translation unit of a
+// program, runtests keeps the default uninstrumented build.
+#define ESTD_FILES_INSTRUMENTATION
+
+#include <iostream>
+
+#include <chrono>
+#include <estd/filesystem.hpp>
+#include <fstream>
+#include <thread>
+
+#include "../unit_tests.hpp"
+
+using std::cout;
+using std::endl;
+
+namespace fs = estd::files;
+namespace in = fs::instrumentation;
+
+int main() {
+    UnitTests test;
+    cout << "[filesystem instrumentation tests]" << endl;
+
+    test.testLambda([&] {
+        fs::remove("sandbox");
+        return true;
+    });
+
+    test.testLambda([&] {
+        struct Counting : in::Hook {
+            int starts = 0, ends = 0, failed = 0;
+            void start(in::Operation, const fs::Path&) override { starts++; }
+            void end(in::Operation, const fs::Path&, std::chrono::nanoseconds, bool f) override {
+                ends++;
+                failed += f;
+            }
+        } hook;
+        fs::createDirectories("sandbox/src/sub/");
+        fs::createDirectories("sandbox/dst2/");
+        std::ofstream("sandbox/dst2/sub") << "a file where the source has a directory";
+        std::ofstream("sandbox/src/a.txt") << "abc";
+        std::ofstream("sandbox/src/sub/b.txt") << "de";
+        fs::createSoftLinkRelative("a.txt", "sandbox/src/link");
+
+        in::reset();
+        in::setHook(&hook);
+        fs::copy("sandbox/src/", "sandbox/dst/", fs::CopyOptions::recursive);
+        in::Snapshot s = in::snapshot();
+        bool counted = s[in::Counter::bytesCopied] == 5 && s[in::Counter::entriesVisited] == 4 &&
+                       s[in::Counter::softLink] == 1 && s[in::Counter::errorsSwallowed] == 0 &&
+                       s[in::Operation::copyFile].samples == 2 && s[in::Operation::copySoftLink].samples == 1 &&
+                       s[in::Operation::copy].quantile(1) >= s[in::Operation::copy].quantile(0.5);
+        bool threw = false;
+        try {
+            fs::copy("sandbox/src/", "sandbox/dst2/", fs::CopyOptions::recursive | fs::CopyOptions::skipExisting);
+        } catch (std::exception&) { threw = true; }
+        in::setHook(nullptr);
+        bool swallowed = threw && in::snapshot()[in::Counter::errorsSwallowed] == 1;
+        in::reset();
+        return counted && swallowed && hook.starts == hook.ends && hook.failed >= 2 &&
+               in::snapshot()[in::Operation::copy].samples == 0;
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/dir/sub/");
+        std::ofstream("sandbox/dir/a.txt") << "a";
+        std::ofstream("sandbox/dir/sub/b.txt") << "b";
+        in::reset();
+        fs::remove("sandbox/dir/");
+        in::Snapshot s = in::threadSnapshot();
+        bool removed = s[in::Counter::unlink] >= 4 && s[in::Operation::remove].samples == 1 &&
+                       s[in::Operation::remove].nanoseconds > 0;
+
+        // counters of worker threads that already ended are kept
+        std::thread([] { in::count(in::Counter::open, 3); }).join();
+        return removed && in::snapshot()[in::Counter::open] == s[in::Counter::open] + 3 &&
+               in::threadSnapshot()[in::Counter::open] == s[in::Counter::open];
+    });
+    fs::remove("sandbox");
+
+    cout << endl << test.getStats() << endl;
+    return 0;
+}
@@ -1,61 +1,30 @@
 #include <iostream>
 
+#include <atomic>
+#include <cstdlib>
 #include <estd/AnsiEscape.hpp>
 #include <estd/filesystem.hpp>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <mutex>
+#include <new>
+#include <set>
 
+#include "unit_tests.hpp"
 
 using std::cout;
 using std::endl;
 
-class UnitTests {
-private:
-    uint32_t testNum = 0;
-    uint32_t passedNum = 0;
-
-public:
-    bool verbose = true;
-    void testBool(const char* file, int line, const char* func, bool val) {
-        using std::cout;
-        using std::endl;
-        testNum++;
-        if (val) {
-            cout << "[" << estd::setTextColor(0, 255, 0) << "PASS" << estd::clearSettings << "] test number ";
-            passedNum++;
-        } else {
-            cout << "[" << estd::setTextColor(255, 0, 0) << "FAIL" << estd::clearSettings << "] test number ";
-        }
-        cout << testNum << " (" << file << ":" << line << ")" << endl;
-    }
+static std::atomic<size_t> allocations{0}; // counts heap allocations to check allocation free code paths
 
-    void testLambda(const char* file, int line, const char* func, std::function<bool()> test) {
-        using std::cout;
-        using std::endl;
-        testNum++;
-        bool testResult = false;
-        try {
-            testResult = test();
-        } catch (std::exception& e) {
-            if (verbose) { cout << e.what() << endl; }
-        } catch (...) {};
-        if (testResult) {
-            cout << "[" << estd::setTextColor(0, 255, 0) << "PASS" << estd::clearSettings << "] test number ";
-            passedNum++;
-        } else {
-            cout << "[" << estd::setTextColor(255, 0, 0) << "FAIL" << estd::clearSettings << "] test number ";
-        }
-        cout << testNum << " (" << file << ":" << line << ")" << endl;
-    }
-
-    std::string getStats() {
-        return std::string() + "TEST RESULTS: " + std::to_string(passedNum) + "/" + std::to_string(testNum);
-    }
-};
-
-#define testBool(...) testBool(__FILE__, __LINE__, __func__, __VA_ARGS__)
-#define testLambda(...) testLambda(__FILE__, __LINE__, __func__, __VA_ARGS__)
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
 
 
 
@@ -73,6 +42,10 @@ int main() {
     test.testBool(fs::Path{"./test/."}.normalize() == "test/");
     test.testBool(fs::Path{"./test/./././"}.normalize() == "test/");
     test.testBool(fs::Path{"./test/././../"}.normalize() == "./"); // todo: bad behavior
+    test.testBool(fs::Path{"a//b/../../../c/./"}.normalize() == "../c/");
+    test.testBool(fs::Path{"/../a/b/.."}.normalize() == "/a/");
+    test.testBool(fs::Path{"a/../..//."}.normalize() == "..");
+    test.testBool(fs::Path{"a\\b\\..\\c"}.normalize() == "a/c");
 
     test.testBool(fs::Path{"/home/user/Desktop"}.hasSuffix());
     test.testBool(!fs::Path{"/home/user/"}.hasSuffix());
@@ -200,6 +173,522 @@ int main() {
         return true;
     });
 
+    fs::remove("sandbox");
+    test.testLambda([&] {
+        for (int i = 0; i < 8; i++) {
+            fs::createDirectories("sandbox/dir" + std::to_string(i) + "/subdir/");
+            for (int j = 0; j < 16; j++) {
+                std::ofstream("sandbox/dir" + std::to_string(i) + "/subdir/file" + std::to_string(j) + ".txt").put('a');
+            }
+        }
+        fs::createSoftLink("sandbox/dir0/subdir/", "sandbox/link/");
+        fs::copyParallel("sandbox/", "sandbox_copy/", fs::CopyOptions::recursive, 4);
+        size_t count = 0;
+        for (auto e : fs::RecursiveDirectoryIterator("sandbox_copy/")) count++;
+        return count == 8 * 18 + 1 && fs::isSoftLink("sandbox_copy/link") &&
+               fs::exists("sandbox_copy/dir7/subdir/file15.txt");
+    });
+    test.testLambda([&] {
+        fs::copy(
+            "sandbox/",
+            "sandbox_copy/",
+            fs::CopyOptions::recursive | fs::CopyOptions::parallel | fs::CopyOptions::skipExisting
+        );
+        try {
+            fs::copyParallel("sandbox/dir1/", "sandbox_copy/dir1/", fs::CopyOptions::recursive, 4);
+        } catch (...) { return true; }
+        return false;
+    });
+    fs::remove("sandbox");
+    fs::remove("sandbox_copy");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/dir/subdir/");
+        std::ofstream("sandbox/dir/file1.txt").put('a');
+        fs::createSoftLink("sandbox/dir/subdir/", "sandbox/dir/dirlink/");
+        fs::createSoftLink("sandbox/dir/file1.txt", "sandbox/dir/filelink");
+        fs::createSoftLinkRelative("missing", "sandbox/dir/broken");
+        std::set<fs::Path> expected, actual;
+        for (auto e : fs::DirectoryIterator("sandbox/dir")) expected.insert(e.path());
+        for (const auto& e : fs::FastDirectoryIterator("sandbox/dir")) actual.insert(e.path());
+        return expected == actual && expected.size() == 5 && actual.count("sandbox/dir/dirlink/") &&
+               actual.count("sandbox/dir/broken");
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                fs::Path dir = "sandbox/d" + std::to_string(i) + "/s" + std::to_string(j) + "/";
+                fs::createDirectories(dir);
+                std::ofstream((dir + "f.txt").string()).put('a');
+            }
+        }
+        fs::createSoftLink("sandbox/d0/", "sandbox/link/");
+        std::mutex m;
+        std::set<fs::Path> all, pruned, shallow;
+        fs::walkParallel("sandbox/", [&](const fs::FastDirectoryEntry& e) {
+            std::lock_guard<std::mutex> lk(m);
+            all.insert(e.path());
+            return fs::WalkAction::proceed;
+        });
+        fs::walkParallel("sandbox/", [&](const fs::FastDirectoryEntry& e) {
+            std::lock_guard<std::mutex> lk(m);
+            pruned.insert(e.path());
+            return e.path() == "sandbox/d1/" ? fs::WalkAction::skipSubtree : fs::WalkAction::proceed;
+        });
+        fs::WalkOptions options;
+        options.maxDepth = 2;
+        options.deterministic = true;
+        std::vector<fs::Path> ordered;
+        fs::walkParallel(
+            "sandbox/",
+            [&](const fs::FastDirectoryEntry& e) {
+                ordered.push_back(e.path());
+                return e.path() == "sandbox/d2/" ? fs::WalkAction::skipSubtree : fs::WalkAction::proceed;
+            },
+            options
+        );
+        return all.size() == 4 + 16 + 16 + 1 && all.count("sandbox/link/") && !all.count("sandbox/link/s0/") &&
+               pruned.size() == all.size() - 8 && !pruned.count("sandbox/d1/s0/") && ordered.size() == 4 + 12 + 1 &&
+               ordered[0] == "sandbox/d0/" && ordered[1] == "sandbox/d0/s0/" && ordered[10] == "sandbox/d2/" &&
+               ordered[11] == "sandbox/d3/" && ordered.back() == "sandbox/link/";
+    });
+    fs::remove("sandbox");
+
+    auto readAll = [](fs::Path p) {
+        std::ifstream in(p.string(), std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/");
+        std::string data;
+        for (int i = 0; i < (1 << 20); i++) data += char('a' + i % 26);
+        std::ofstream("sandbox/big.bin", std::ios::binary) << data;
+        fs::copyFile("sandbox/big.bin", "sandbox/big2.bin");
+        fs::copyFile(
+            "sandbox/big.bin",
+            "sandbox/big2.bin",
+            fs::CopyOptions::overwriteExisting | fs::CopyOptions::reflinkPreferred
+        );
+        try {
+            fs::copyFile("sandbox/big.bin", "sandbox/big3.bin", fs::CopyOptions::reflinkOnly);
+            if (readAll("sandbox/big3.bin") != data) return false;
+        } catch (fs::FileException&) {
+            if (fs::exists("sandbox/big3.bin")) return false; // no partial file left behind
+        }
+        return readAll("sandbox/big2.bin") == data;
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        std::string data(300000, 'x');
+        for (int i = 0; i < 4; i++) {
+            fs::createDirectories("sandbox/d" + std::to_string(i) + "/sub/");
+            for (int j = 0; j < 32; j++) {
+                std::ofstream("sandbox/d" + std::to_string(i) + "/sub/f" + std::to_string(j)) << std::to_string(j);
+            }
+        }
+        std::ofstream("sandbox/empty.txt");
+        std::ofstream("sandbox/big.bin") << data;
+        fs::createSoftLink("sandbox/big.bin", "sandbox/link");
+        fs::setPermissions("sandbox/d1/sub/f0", fs::Permissions(0666));
+        mode_t mask = ::umask(022);
+        fs::copyBatched("sandbox/d1/", "sandbox_perms/", fs::CopyOptions::recursive);
+        ::umask(mask);
+        bool exactMode = fs::getPermissions("sandbox_perms/sub/f0") == fs::Permissions(0666);
+        fs::remove("sandbox_perms");
+        fs::copy("sandbox/", "sandbox_copy/", fs::CopyOptions::recursive | fs::CopyOptions::ioUring);
+        fs::copyBatched("sandbox/", "sandbox_copy/", fs::CopyOptions::recursive | fs::CopyOptions::skipExisting);
+        bool threw = false;
+        try {
+            fs::copyBatched("sandbox/d0/", "sandbox_copy/d0/");
+        } catch (std::exception&) { threw = true; }
+        bool result = threw && readAll("sandbox_copy/big.bin") == data && readAll("sandbox_copy/d3/sub/f31") == "31" &&
+                      fs::exists("sandbox_copy/empty.txt") && fs::isSoftLink("sandbox_copy/link") && exactMode;
+        uintmax_t removed = fs::remove("sandbox_copy/");
+        return result && removed == 4 * 34 + 4 && !fs::exists("sandbox_copy");
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        for (int i = 0; i < 8; i++) {
+            fs::createDirectories("sandbox/d" + std::to_string(i) + "/a/b/");
+            std::ofstream("sandbox/d" + std::to_string(i) + "/a/b/f");
+            std::ofstream("sandbox/d" + std::to_string(i) + "/g");
+        }
+        fs::createSoftLink("sandbox/d0/", "sandbox/link/");
+        uintmax_t removed = fs::removeParallel("sandbox/d7/") + fs::removeParallel("sandbox/link/");
+        bool parallel = removed == 5 + 1 && fs::exists("sandbox/d0/a/b/f") && fs::removeParallel("sandbox/") == 1 + 35;
+
+        fs::createDirectories("sandbox/big/sub/");
+        std::ofstream("sandbox/big/sub/file");
+        std::ofstream("sandbox/file");
+        fs::removeDeferred("sandbox/big/");
+        fs::removeDeferred("sandbox/file");
+        bool renamed = !fs::exists("sandbox/big") && !fs::exists("sandbox/file");
+        fs::waitForDeferredRemovals();
+
+        fs::Path tmp;
+        {
+            fs::TmpDir dir("sandbox/");
+            tmp = dir.path().string();
+            fs::createDirectories(tmp / "x/y/");
+            std::ofstream((tmp / "z").string());
+            dir.discard();
+            renamed = renamed && fs::exists(tmp) && fs::FastDirectoryIterator(tmp) == fs::FastDirectoryIterator();
+        }
+        fs::waitForDeferredRemovals();
+        return parallel && renamed && !fs::exists(tmp) && !fs::exists("sandbox/.estd_trash");
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        // subdirectories removed by another thread between the listing and their open must not keep the parents
+        bool removedAll = true;
+        for (int round = 0; round < 4; round++) {
+            std::vector<std::string> subdirectories;
+            for (int i = 0; i < 2000; i++) subdirectories.push_back("sandbox/parent/d" + std::to_string(i));
+            for (const auto& d : subdirectories) fs::createDirectories(d + "/");
+            std::reverse(subdirectories.begin() + 1000, subdirectories.end());
+            std::thread racer([&] {
+                for (const auto& d : subdirectories) ::rmdir(d.c_str());
+            });
+            fs::removeParallel("sandbox/", 1);
+            racer.join();
+            removedAll = removedAll && !fs::exists("sandbox");
+            fs::remove("sandbox");
+        }
+        return removedAll;
+    });
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/");
+        fs::Path first;
+        bool recycled = false;
+        {
+            fs::TmpDirPool pool("sandbox/", 1, 1);
+            {
+                auto lease = pool.acquire();
+                first = lease.path();
+                fs::createDirectories(first / "job/out/");
+                std::ofstream((first / "job/out/result").string()) << "done";
+                recycled = pool.idle() == 0 && fs::isDirectory(first);
+            }
+            auto again = pool.acquire();
+            auto other = pool.acquire();
+            recycled = recycled && again.path() == first && other.path() != first &&
+                       fs::FastDirectoryIterator(first) == fs::FastDirectoryIterator();
+        }
+        fs::waitForDeferredRemovals();
+        bool cleaned = !fs::exists(first);
+
+        std::string contents;
+        {
+            fs::TmpFile file("sandbox/");
+            file.write("written ");
+            file.write("before linking");
+            bool hidden = fs::FastDirectoryIterator("sandbox/") == fs::FastDirectoryIterator();
+            file.link("sandbox/final.txt");
+            std::ofstream("sandbox/replaced.txt") << "old";
+            fs::TmpFile second("sandbox/");
+            second.write("new");
+            second.link("sandbox/replaced.txt", true);
+            contents = hidden && file.linked() ? readAll("sandbox/final.txt") + "|" + readAll("sandbox/replaced.txt")
+                                               : "";
+        }
+        fs::TmpFile("sandbox/").write("never linked");
+        {
+            fs::TmpFile named("sandbox/", 0600, true);
+            named.write("visible until assigned over");
+            bool visible = false;
+            for (const auto& e : fs::FastDirectoryIterator("sandbox/")) {
+                visible = visible || e.path().getSuffix().string().rfind(".tmp_", 0) == 0;
+            }
+            named = fs::TmpFile("sandbox/", 0600, true); // must unlink the first hidden file
+            fs::TmpFile moved(std::move(named));
+            moved.write("named");
+            moved.link("sandbox/named.txt");
+            contents += visible ? "|" + readAll("sandbox/named.txt") : "";
+        }
+        size_t entries = 0;
+        for (const auto& e : fs::FastDirectoryIterator("sandbox/")) entries += e.path().getSuffix() != ".estd_trash";
+        return recycled && cleaned && contents == "written before linking|new|named" && entries == 3;
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/");
+        std::ofstream("sandbox/index.bin") << "0123456789";
+        std::ofstream("sandbox/empty.bin");
+        fs::MappedFile index("sandbox/index.bin", fs::MapMode::readOnly, true);
+        bool read = index.view() == "0123456789" && index.advise(fs::MapAdvice::random, 3, 4);
+        index.advise(fs::MapAdvice::hugePage); // a hint, may be rejected
+
+        fs::MappedFile copy("sandbox/index.bin", fs::MapMode::copyOnWrite);
+        copy.data()[0] = 'X';
+        bool private_ = copy.view() == "X123456789" && readAll("sandbox/index.bin") == "0123456789";
+
+        fs::MappedFile grow("sandbox/empty.bin", fs::MapMode::readWrite);
+        bool empty = grow.empty() && grow.data() == nullptr;
+        grow.resize(4);
+        std::memcpy(grow.data(), "abcd", 4);
+        grow.resize(6);
+        std::memcpy(grow.data() + 4, "ef", 2);
+        grow.sync();
+        fs::MappedFile created("sandbox/new.bin", fs::MapMode::readWrite);
+        return read && private_ && empty && readAll("sandbox/empty.bin") == "abcdef" && created.empty() &&
+               fs::exists("sandbox/new.bin");
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/");
+        std::string big(100000, 'q');
+        fs::writeFileAtomic("sandbox/state.json", "{}");
+        fs::setPermissions("sandbox/state.json", 0600);
+        fs::writeFileAtomic("sandbox/state.json", big, fs::SyncPolicy::fileAndDirectory);
+        bool written = fs::readFile("sandbox/state.json") == big &&
+                       fs::getPermissions("sandbox/state.json") == fs::Permissions(0600);
+
+        std::string buffer;
+        buffer.reserve(200000);
+        const char* capacity = buffer.data();
+        size_t size = fs::readFile("sandbox/state.json", buffer);
+        std::ofstream("sandbox/empty");
+        bool reused = size == big.size() && buffer.data() == capacity && fs::readFile("sandbox/empty").empty() &&
+                      fs::readFile("/proc/self/status").find("Name:") != std::string::npos;
+        size_t entries = 0;
+        for (const auto& e : fs::FastDirectoryIterator("sandbox/")) entries += e.isFile();
+        return written && reused && entries == 2;
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/watched/old/");
+        fs::Watcher watcher("sandbox/watched", std::chrono::milliseconds(20));
+        bool idle = watcher.poll(std::chrono::milliseconds(0)).empty() && watcher.watchCount() == 2;
+
+        std::ofstream("sandbox/watched/a.txt") << "a";
+        fs::createDirectories("sandbox/watched/new/deep/");
+        std::ofstream("sandbox/watched/new/deep/b.txt") << "b";
+        std::set<fs::Path> seen;
+        for (int i = 0; i < 10 && !seen.count("sandbox/watched/new/deep/b.txt"); i++) {
+            for (const auto& p : watcher.poll(std::chrono::milliseconds(200)).paths) seen.insert(p);
+        }
+        bool created = seen.count("sandbox/watched/a.txt") && seen.count("sandbox/watched/new/") &&
+                       seen.count("sandbox/watched/new/deep/") && watcher.watchCount() == 4;
+
+        fs::rename("sandbox/watched/old/", "sandbox/moved/");
+        std::ofstream("sandbox/moved/outside.txt");
+        auto moved = watcher.poll(std::chrono::milliseconds(200));
+        bool dropped = moved.paths == std::vector<fs::Path>{"sandbox/watched/old/"} && watcher.watchCount() == 3;
+        return idle && created && dropped;
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::Glob glob{"src/**/*.{cpp,hpp}", "!src/build/", "docs/"};
+        bool compiled = glob.matches("src/a.cpp") && glob.matches("src/x/y/z.hpp") && !glob.matches("src/a.h") &&
+                        !glob.matches("src/build/a.cpp") && glob.matches("docs/") && !glob.matches("docs") &&
+                        glob.mayMatchBelow("src/x/") && !glob.mayMatchBelow("src/build/") &&
+                        !glob.mayMatchBelow("lib/") && !glob.mayMatchBelow("docs/") &&
+                        fs::Glob("[a-c]?.t*t").matches("b1.txt") && !fs::Glob("[!a-c]*").matches("abc") &&
+                        fs::Glob("!*.o").matches("x/y.c") && !fs::Glob("!*.o").matches("y.o");
+
+        fs::createDirectories("sandbox/src/x/");
+        fs::createDirectories("sandbox/src/build/");
+        fs::createDirectories("sandbox/lib/");
+        fs::createDirectories("sandbox/docs/");
+        for (const char* f : {"src/a.cpp", "src/a.h", "src/x/b.hpp", "src/build/c.cpp", "lib/d.cpp", "docs/e.cpp"}) {
+            std::ofstream(fs::Path("sandbox/") + f);
+        }
+        bool walked = fs::glob("sandbox", glob) ==
+                      std::vector<fs::Path>{"sandbox/docs/", "sandbox/src/a.cpp", "sandbox/src/x/b.hpp"};
+        std::set<fs::Path> iterated;
+        for (const auto& e : fs::GlobIterator("sandbox", glob)) iterated.insert(e.path());
+        return compiled && walked &&
+               iterated == std::set<fs::Path>{"sandbox/docs/", "sandbox/src/a.cpp", "sandbox/src/x/b.hpp"};
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/dir/");
+        std::ofstream("sandbox/dir/file.txt");
+        fs::createSoftLink("sandbox/dir/", "sandbox/hop2");
+        fs::createSoftLinkRelative("hop2", "sandbox/hop1");
+        fs::createSoftLink("sandbox/dir/file.txt", "sandbox/file");
+        fs::createSoftLinkRelative("missing.txt", "sandbox/broken");
+        fs::createSoftLinkRelative("loopB", "sandbox/loopA");
+        fs::createSoftLinkRelative("loopA", "sandbox/loopB");
+
+        fs::LinkResolver resolver(4);
+        const auto& chain = resolver.resolve("sandbox/hop1/");
+        bool followed = chain.target == "sandbox/dir" && chain.hops == 2 && chain.isDirectory() &&
+                        resolver.resolve("sandbox/dir/file.txt").hops == 0 && resolver.misses() == 2;
+        auto all = resolver.resolveAll(std::vector<fs::Path>{"sandbox/hop1/", "sandbox/file", "sandbox/broken"});
+        bool batch = all.size() == 3 && all[0].isDirectory() && all[1].isFile() && all[2].broken() &&
+                     all[2].target == "sandbox/missing.txt" && resolver.hits() == 1 && resolver.size() <= 4;
+        const auto& loop = resolver.resolve("sandbox/loopA");
+        bool looped = loop.loop && loop.broken() && loop.hops == fs::LinkResolver::maxHops;
+        bool soft = fs::isSoftDirectory("sandbox/hop1") && !fs::isSoftFile("sandbox/hop1") &&
+                    fs::isSoftFile("sandbox/file") && fs::isSoftFile("sandbox/broken") &&
+                    !fs::isSoftDirectory("sandbox/loopA") && !fs::isSoftFile("sandbox/loopA");
+        return followed && batch && looped && soft;
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/a/b/");
+        fs::createDirectories("sandbox/c/");
+        std::ofstream("sandbox/top.txt") << std::string(100, 't');
+        std::ofstream("sandbox/a/one.txt") << std::string(10, '1');
+        std::ofstream("sandbox/a/b/two.txt") << std::string(1000, '2');
+        fs::createHardLink("sandbox/a/b/two.txt", "sandbox/c/same.txt");
+        fs::createSoftLinkRelative("../top.txt", "sandbox/c/link");
+
+        fs::DiskUsageCache cache;
+        fs::DiskUsageOptions options;
+        options.cache = &cache;
+        auto usage = fs::diskUsage("sandbox", options);
+        const fs::DiskUsage& total = usage["sandbox/"];
+        bool counted = usage.size() == 4 && total.files == 4 && total.directories == 3 &&
+                       total.apparentSize == 100 + 10 + 1000 + 10 && usage["sandbox/a/"].apparentSize == 1010 &&
+                       usage["sandbox/a/"].directories == 1 && usage["sandbox/a/b/"].files == 1 &&
+                       total.allocatedSize >= usage["sandbox/a/"].allocatedSize && cache.size() == 4;
+
+        auto again = fs::diskUsage("sandbox", options);
+        bool cached = cache.hits() == 4 && again["sandbox/"].apparentSize == total.apparentSize;
+        std::ofstream("sandbox/a/b/three.txt") << "333";
+        auto changed = fs::diskUsage("sandbox", options);
+        bool rescanned = cache.hits() == 7 && cache.misses() == 5 && changed["sandbox/a/b/"].files == 2 &&
+                         changed["sandbox/"].apparentSize == total.apparentSize + 3;
+        options.hardLinksOnce = false;
+        bool linksTwice = fs::diskUsage("sandbox", options)["sandbox/"].files == 6;
+        return counted && cached && rescanned && linksTwice;
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/src/same/");
+        fs::createDirectories("sandbox/src/new/deep/");
+        fs::createDirectories("sandbox/src/kind/");
+        std::ofstream("sandbox/src/same/a.txt") << "same";
+        std::ofstream("sandbox/src/new/deep/b.txt") << "b";
+        std::ofstream("sandbox/src/edited.txt") << "version 2";
+        std::ofstream("sandbox/src/touched.txt") << "1234";
+        fs::createSoftLinkRelative("same/a.txt", "sandbox/src/link");
+        fs::createSoftLinkRelative("same", "sandbox/src/dirlink");
+        fs::copy("sandbox/src/", "sandbox/dst/", fs::CopyOptions::recursive);
+        std::ofstream("sandbox/src/edited.txt") << "version 3!";
+        std::ofstream("sandbox/dst/touched.txt") << "abcd"; // same size, newer in the destination
+        fs::remove("sandbox/dst/new/");
+        fs::remove("sandbox/dst/kind/");
+        std::ofstream("sandbox/dst/kind") << "was a directory";
+        fs::remove("sandbox/dst/link");
+        fs::createSoftLinkRelative("edited.txt", "sandbox/dst/link");
+        std::ofstream("sandbox/dst/extra.txt") << "only here";
+
+        using Change = fs::TreeDiff::Change;
+        auto diff = fs::treeDiff("sandbox/src", "sandbox/dst/");
+        std::vector<std::pair<fs::Path, Change>> changes;
+        for (const auto& e : diff.entries) changes.push_back({e.path, e.change});
+        bool found = changes == std::vector<std::pair<fs::Path, Change>>{
+                                    {"edited.txt", Change::modified}, {"extra.txt", Change::removed},
+                                    {"kind/", Change::typeChanged}, {"link", Change::modified},
+                                    {"new/", Change::added}
+                                };
+        auto content = fs::treeDiff("sandbox/src", "sandbox/dst", fs::DiffMode::content);
+        bool byContent = content.size() == 6 && content.entries[5].path == "touched.txt";
+
+        fs::copy("sandbox/src", "sandbox/dst", content);
+        bool synced = fs::treeDiff("sandbox/src", "sandbox/dst", fs::DiffMode::content).empty() &&
+                      readAll("sandbox/dst/new/deep/b.txt") == "b" && !fs::exists("sandbox/dst/extra.txt") &&
+                      fs::followSoftLink("sandbox/dst/link") == "same/a.txt";
+        return found && byContent && synced && fs::treeDiff("sandbox/src", "sandbox/missing").size() == 7;
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/dir/sub/");
+        std::ofstream("sandbox/dir/sub/a.txt") << "a";
+        std::ofstream("sandbox/dir/b.txt") << "b";
+        fs::createSoftLink("sandbox/dir/sub/", "sandbox/link/");
+        fs::copyIncremental(
+            "sandbox/",
+            "sandbox_copy/",
+            fs::CopyOptions::recursive | fs::CopyOptions::updateExisting,
+            fs::ManifestOptions::manifestHashContents
+        );
+        fs::CopyManifest manifest;
+        manifest.load(fs::CopyManifest::defaultLocation("sandbox_copy/"));
+        bool first = manifest.size() == 6 && manifest.find("dir/sub/a.txt") && manifest.find("link") &&
+                     readAll("sandbox_copy/dir/sub/a.txt") == "a";
+
+        // unchanged entries are trusted from the manifest, changed ones are copied again
+        std::ofstream("sandbox_copy/dir/b.txt") << "edited in the copy";
+        std::ofstream("sandbox/dir/sub/a.txt") << "changed";
+        std::ofstream("sandbox/dir/c.txt") << "c";
+        fs::copyIncremental("sandbox/", "sandbox_copy/");
+        manifest.load(fs::CopyManifest::defaultLocation("sandbox_copy/"));
+        bool second = manifest.size() == 7 && readAll("sandbox_copy/dir/sub/a.txt") == "changed" &&
+                      readAll("sandbox_copy/dir/c.txt") == "c" &&
+                      readAll("sandbox_copy/dir/b.txt") == "edited in the copy";
+        fs::remove("sandbox_copy.manifest");
+        return first && second;
+    });
+    fs::remove("sandbox");
+    fs::remove("sandbox_copy");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/a/");
+        fs::createDirectories("sandbox/b/");
+        std::ofstream("sandbox/a/one.txt") << "same content";
+        std::ofstream("sandbox/b/two.txt") << "same content";
+        std::ofstream("sandbox/b/other.txt") << "diff content"; // same size, different data
+        std::ofstream("sandbox/unique.txt") << "unique";
+        fs::copy("sandbox/", "sandbox_copy/", fs::CopyOptions::recursive | fs::CopyOptions::dedupe);
+        return std::filesystem::equivalent("sandbox_copy/a/one.txt", "sandbox_copy/b/two.txt") &&
+               !std::filesystem::equivalent("sandbox_copy/a/one.txt", "sandbox_copy/b/other.txt") &&
+               readAll("sandbox_copy/b/other.txt") == "diff content" &&
+               readAll("sandbox_copy/b/two.txt") == "same content" && readAll("sandbox_copy/unique.txt") == "unique";
+    });
+    fs::remove("sandbox");
+    fs::remove("sandbox_copy");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/dir/");
+        std::ofstream("sandbox/dir/file.txt") << "12345";
+        fs::createSoftLink("sandbox/dir/", "sandbox/link/");
+        fs::FileStatus file("sandbox/dir/file.txt"), dir("sandbox/dir"), link("sandbox/link"), missing("sandbox/no");
+        bool status = file.isFile() && file.size() == 5 && dir.isDirectory() && !dir.isSoftLink() &&
+                      link.isSoftLink() && link.isDirectory() && !missing.exists() &&
+                      file.modificationTime() != 0;
+        bool listed = false;
+        for (const auto& e : fs::FastDirectoryIterator("sandbox/dir/")) {
+            listed = e.fileStatus().inode() == file.inode() && e.fileStatus().size() == 5;
+        }
+        fs::copy("sandbox/dir/file.txt", file, "sandbox/copy.txt");
+        fs::copy("sandbox/link/", link, "sandbox/link2/");
+        return status && listed && readAll("sandbox/copy.txt") == "12345" && fs::isSoftLink("sandbox/link2");
+    });
+    fs::remove("sandbox");
+
+    test.testLambda([&] {
+        fs::createDirectories("sandbox/a/b/c/d/");
+        std::ofstream("sandbox/a/b/c/d/file.txt") << "deep";
+        fs::createSoftLink("sandbox/a/b/", "sandbox/a/link/");
+        fs::createSoftLinkRelative("missing", "sandbox/a/broken");
+        fs::copy("sandbox/", "sandbox_copy/");
+        std::ofstream("sandbox/a/b/c/d/file.txt") << "changed";
+        fs::copy("sandbox/", "sandbox_copy/", fs::CopyOptions::recursive | fs::CopyOptions::overwriteExisting);
+        bool copied = readAll("sandbox_copy/a/b/c/d/file.txt") == "changed" && fs::isSoftLink("sandbox_copy/a/link") &&
+                      fs::isSoftLink("sandbox_copy/a/broken") && fs::isDirectory("sandbox_copy/a/link/");
+        bool linkOnly = fs::remove("sandbox_copy/a/link/") == 1 && fs::exists("sandbox_copy/a/b/c/d/file.txt");
+        return copied && linkOnly && fs::remove("sandbox_copy/") == 7 && fs::remove("sandbox_copy/") == 0;
+    });
+    fs::remove("sandbox");
+
     p = "./some/root/path/img112.jpeg";
     test.testBool(p.getExtention() == p.getLongExtention() && p.getExtention() == ".jpeg");
     test.testBool(
@@ -250,6 +739,148 @@ int main() {
         p.splitLongExtention().second == "."
     );
 
+    for (std::string str :
+         {"./some/root/path/fileone.txt.jpeg.zip",
+          "/.fileone.txt.jpeg.zip",
+          ".fileone",
+          "this/is.dir/",
+          "this/.file.",
+          "home/user/Desktop",
+          "/",
+          ""}) {
+        fs::Path p = str;
+        fs::PathView v = str;
+        test.testBool(
+            v.splitExtention().first == p.splitExtention().first &&
+            v.splitExtention().second == p.splitExtention().second &&
+            v.splitLongExtention().first == p.splitLongExtention().first &&
+            v.splitLongExtention().second == p.splitLongExtention().second &&
+            v.splitPrefix().first == p.splitPrefix().first && v.splitPrefix().second == p.splitPrefix().second &&
+            v.splitSuffix().first == p.splitSuffix().first && v.splitSuffix().second == p.splitSuffix().second &&
+            v.removeEmptySuffix() == p.removeEmptySuffix() && v.isDirectory() == p.isDirectory()
+        );
+    }
+    test.testLambda([&] {
+        std::string str = "./some/root/path/.fileone.txt.jpeg.zip";
+        size_t before = allocations;
+        fs::PathView v = str;
+        bool result = v.getExtention() == ".zip" && v.getLongExtention() == ".txt.jpeg.zip" &&
+                      v.splitLongExtention().first == "./some/root/path/.fileone" &&
+                      v.getSuffix() == ".fileone.txt.jpeg.zip" && v.getPrefix() == "." && v.isFile() &&
+                      fs::PathView("a/b/").isDirectory() && fs::PathView("a/b/").removeEmptySuffix() == "a/b";
+        return result && allocations == before;
+    });
+
+    p = "/home/user/file.tar.gz";
+    test.testBool(p.componentCount() == 4 && p.componentAt(0) == "" && p.componentAt(3) == "file.tar.gz");
+    test.testLambda([&] {
+        std::vector<size_t> separators;
+        p.separators(separators);
+        try {
+            p.componentAt(4);
+            return false;
+        } catch (std::out_of_range&) {}
+        return separators == std::vector<size_t>{0, 5, 10} && p.componentAt(2) == "user";
+    });
+    test.testLambda([&] {
+        fs::Path deep = "a/b/c/d/e/f/g/h/i/j/file.txt"; // more separators than the index keeps inline
+        bool indexed = deep.componentAt(9) == "j" && deep.componentCount() == 11;
+        fs::Path copy = deep;
+        deep /= "x";
+        std::vector<size_t> separators;
+        copy.separators(separators);
+        return indexed && copy.componentAt(10) == "file.txt" && copy.getSuffix() == "file.txt" &&
+               separators.size() == 10 && separators.back() == 19 && deep.componentCount() == 12 &&
+               deep.componentAt(11) == "x" && deep.getAntiSuffix() == "a/b/c/d/e/f/g/h/i/j/file.txt";
+    });
+    test.testLambda([&] {
+        const fs::Path shared = "/srv/data/project/file.tar.gz"; // queries only read, no synchronization needed
+        std::atomic<size_t> matches{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 1000; i++) {
+                    matches += shared.getSuffix() == "file.tar.gz" && shared.getLongExtention() == ".tar.gz" &&
+                               shared.componentAt(3) == "project" && shared.getPrefix() == "";
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        return matches == 4000;
+    });
+    test.testBool(p.getSuffix() == "file.tar.gz" && p.getExtention() == ".gz" && p.getLongExtention() == ".tar.gz");
+    p /= "";
+    test.testBool(p.componentCount() == 5 && p.isDirectory() && p.getExtention() == "" && p.getSuffix() == "");
+    p += "more.txt";
+    test.testBool(p.getSuffix() == "more.txt" && p.getAntiSuffix() == "/home/user/file.tar.gz");
+    test.testLambda([&] {
+        fs::Path path = "some/root/path/";
+        size_t before = allocations;
+        std::string_view expected[] = {"some", "root", "path", ""};
+        size_t i = 0;
+        for (fs::PathView component : path.components()) {
+            if (i >= 4 || component != expected[i++]) return false;
+        }
+        return i == 4 && allocations == before;
+    });
+
+    test.testLambda([&] {
+        std::pair<const char*, const char*> mappings[] = {
+            {"/some/root/", "/other/"}, {"/some/root", "/other/root2"}, {"some/", "./"}, {"./", "prefix/"},
+            {"/some/root/path/file.txt", "/other/"}
+        };
+        const char* paths[] = {
+            "/some/root/path/", "/some/root/path/file.txt", "/some/root/", "/some/rooted/x", "./some/root/./path/",
+            "some/a/../b", "../x/y", "/some/root/path/file.txt/", "relative/file", ""
+        };
+        std::string out;
+        for (auto [from, to] : mappings) {
+            fs::PrefixRewriter rewriter(from, to);
+            for (const char* path : paths) {
+                auto expected = fs::Path(path).replacePrefix(from, to);
+                bool rewritten = rewriter.rewrite(path, out);
+                if (rewritten != bool(expected) || (expected && out != expected.value().string())) return false;
+            }
+        }
+        fs::PrefixRewriter rewriter("/staging/", "/release/v2");
+        std::vector<fs::Path> batch = {"/staging/a/b.txt", "/elsewhere/c", "/staging/d/"}, result;
+        size_t count = rewriter.rewrite(batch, result);
+        out.reserve(64);
+        size_t before = allocations;
+        bool fast = rewriter.rewrite(fs::PathView("/staging/some/deep/file.txt"), out) && allocations == before;
+        return fast && out == "/release/v2/some/deep/file.txt" && count == 2 && result[0] == "/release/v2/a/b.txt" &&
+               result[1] == "" && result[2] == "/release/v2/d/";
+    });
+
+    test.testLambda([&] {
+        fs::PathTrie<int> roots;
+        roots["/srv/data/"] = 1;
+        roots["/srv/data/private/keys"] = 2;
+        roots["/srv/database"] = 3;
+        roots["relative/dir/"] = 4;
+        bool inserted = !roots.insert("/srv/data", 5).second && roots.size() == 4 && roots.contains("/srv/data/.");
+        size_t before = allocations;
+        auto* data = roots.longestPrefixOf("/srv/data/public/index.html");
+        auto* keys = roots.longestPrefixOf("/srv//data/private/keys/id_rsa");
+        bool lookups = data && data->second == 1 && keys && keys->second == 2 && !roots.hasPrefixOf("/srv/") &&
+                       !roots.longestPrefixOf("/srv/dat") && roots.hasPrefixOf("./relative/dir/x") &&
+                       allocations == before;
+        bool normalized = roots.find("/srv/x/../database")->second == 3;
+
+        std::vector<int> under, all;
+        roots.forEachUnder("/srv/data", [&](const auto& e) { under.push_back(e.second); });
+        roots.forEach([&](const auto& e) { all.push_back(e.second); });
+        bool listed = under == std::vector<int>{1, 2} && all == std::vector<int>{1, 2, 3, 4};
+
+        bool erased = roots.erase("/srv/data/") && !roots.erase("/srv/data/") && roots.size() == 3 &&
+                      roots.longestPrefixOf("/srv/data/private/keys/x")->second == 2 &&
+                      !roots.hasPrefixOf("/srv/data/public");
+        fs::PathSet set{"b/", "a/c", "./a", "/"};
+        bool ordered = set.paths() == std::vector<fs::Path>{"/", "a", "a/c", "b/"} &&
+                       *set.longestPrefixOf("/etc/passwd") == "/" && *set.longestPrefixOf("a/c/d") == "a/c";
+        return inserted && lookups && normalized && listed && erased && ordered;
+    });
+
     // fs::remove("sandbox");
 
     cout << endl << test.getStats() << endl;